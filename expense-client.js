@@ -0,0 +1,69 @@
+// Promise front end for expense-worker.js. Calls made in the same tick go out as one
+// message and run in issue order, so a sequence like createGroup + applyGroupOps +
+// calculateGroupSettlement costs a single round trip.
+//
+//   const engine = createEngineClient();
+//   const report = await engine.call('getGroupBalances', [groupId]);
+//   const blob = await engine.call('saveSnapshot', [], 'binary'); // ArrayBuffer or null
+//
+// Byte arguments (ArrayBuffer or typed array) are transferred to the worker and become
+// unusable here; pass a copy if you still need them. The *Packed calls take one such
+// buffer of length-prefixed UTF-8 strings (encoded the way packExpensesBatch in
+// index1.html writes them), so text never goes through a C string.
+//
+// Streaming a large statement in and a group back out, one chunk per call:
+//   await engine.call('beginGroupImport', [groupId, 'csv']);
+//   for await (const chunk of file.stream()) await engine.call('feedGroupImport', [groupId, chunk]);
+//   await engine.call('finishGroupImport', [groupId]);
+//   const page = await engine.call('exportGroupExpensesChunk', [groupId, 'csv', cursor, { out: 1 << 20 }]);
+//   // page.bytes holds page.written bytes; repeat from page.cursor until page.done
+
+export function createEngineClient(workerUrl = 'expense-worker.js') {
+  const pending = new Map();
+  let queue = [];
+  let nextId = 1;
+  let worker = null;
+
+  // The worker, and with it the WASM download and instantiation, starts on the first
+  // call rather than with the page, so it stays off the first-paint path.
+  function start() {
+    worker = new Worker(workerUrl);
+    worker.onmessage = ({ data }) => {
+      for (const r of data.results) {
+        const p = pending.get(r.id);
+        pending.delete(r.id);
+        if ('error' in r) p.reject(new Error(r.error));
+        else p.resolve(r.value);
+      }
+    };
+    worker.onerror = e => {
+      const err = new Error(e.message || 'Engine worker failed');
+      pending.forEach(p => p.reject(err));
+      pending.clear();
+    };
+  }
+
+  function flush() {
+    const calls = queue;
+    queue = [];
+    const transfer = new Set();
+    calls.forEach(c => c.args.forEach(a => {
+      if (a instanceof ArrayBuffer) transfer.add(a);
+      else if (ArrayBuffer.isView(a)) transfer.add(a.buffer);
+    }));
+    if (!worker) start();
+    worker.postMessage({ calls }, [...transfer]);
+  }
+
+  // ret: 'json' (default), 'binary' or 'void', as described in expense-worker.js.
+  function call(fn, args = [], ret = 'json') {
+    return new Promise((resolve, reject) => {
+      const id = nextId++;
+      pending.set(id, { resolve, reject });
+      queue.push({ id, fn, args, ret });
+      if (queue.length === 1) queueMicrotask(flush);
+    });
+  }
+
+  return { call, terminate: () => worker && worker.terminate() };
+}
@@ -0,0 +1,88 @@
+// Web Worker host for the expense engine, so heavy calls never run on the UI thread.
+//
+// Build expense.js for web + worker:
+//   emcc -O2 -std=c++17 expense.cpp -o expense.js -sALLOW_MEMORY_GROWTH -sENVIRONMENT=web,worker
+//        -sEXPORTED_RUNTIME_METHODS=ccall,HEAPU8 -sEXPORTED_FUNCTIONS=_malloc,_free,<the exports in expense.h>
+//   (add -DSPENDSENSE_STATS to have getEngineStats report per-call counters and latency)
+// Size-optimized build for mobile first paint, same exports:
+//   emcc -Oz -flto -std=c++17 expense.cpp -o expense.js -sALLOW_MEMORY_GROWTH -sENVIRONMENT=worker
+//        -sFILESYSTEM=0 -sMALLOC=emmalloc -sASSERTIONS=0 -sTEXTDECODER=2 --closure 1
+//        -sEXPORTED_RUNTIME_METHODS=ccall,HEAPU8 -sEXPORTED_FUNCTIONS=_malloc,_free,<the exports in expense.h>
+//   Serve expense.wasm as application/wasm so it compiles while it streams in
+//   (WebAssembly.instantiateStreaming); otherwise the runtime falls back to a full download first.
+//   expense-client.js only starts this worker on the first engine call.
+//
+// Talk to it through expense-client.js. Each message is a batch,
+//   { calls: [{ id, fn, args, ret }] },
+// answered in order with { results: [{ id, value } | { id, error }] }.
+// A string arg is passed as a C string, a number as a number, and an ArrayBuffer or
+// typed array is copied into WASM memory and passed as (pointer, byteLength).
+// { out: byteLength } passes an empty output buffer the same way, for
+// exportGroupExpensesChunk; its first "written" bytes come back as the result's "bytes".
+// ret is 'json' (parsed here), 'binary' (the last binary export, copied into a fresh
+// ArrayBuffer and transferred back) or 'void'.
+
+let resolveReady;
+const ready = new Promise(resolve => { resolveReady = resolve; });
+var Module = { onRuntimeInitialized: () => resolveReady() };
+importScripts('expense.js');
+
+function runCall(call, transfer) {
+  const types = [], values = [], temps = [];
+  let out = null;
+  try {
+    for (const arg of call.args || []) {
+      if (arg instanceof ArrayBuffer || ArrayBuffer.isView(arg)) {
+        const bytes = arg instanceof ArrayBuffer ? new Uint8Array(arg) : new Uint8Array(arg.buffer, arg.byteOffset, arg.byteLength);
+        const ptr = Module._malloc(bytes.length || 1);
+        temps.push(ptr);
+        Module.HEAPU8.set(bytes, ptr);
+        types.push('number', 'number');
+        values.push(ptr, bytes.length);
+      } else if (arg && typeof arg === 'object' && 'out' in arg) {
+        const ptr = Module._malloc(arg.out || 1);
+        temps.push(ptr);
+        out = ptr;
+        types.push('number', 'number');
+        values.push(ptr, arg.out);
+      } else {
+        types.push(typeof arg === 'string' ? 'string' : 'number');
+        values.push(arg);
+      }
+    }
+
+    if (call.ret === 'binary') {
+      const ptr = Module.ccall(call.fn, 'number', types, values);
+      if (!ptr) return null;
+      const size = Module.ccall('getLastBinarySize', 'number', [], []);
+      const out = Module.HEAPU8.slice(ptr, ptr + size).buffer;
+      transfer.push(out);
+      return out;
+    }
+    if (call.ret === 'void') {
+      Module.ccall(call.fn, null, types, values);
+      return null;
+    }
+    const value = JSON.parse(Module.ccall(call.fn, 'string', types, values));
+    if (out !== null && value.written) {
+      value.bytes = Module.HEAPU8.slice(out, out + value.written).buffer;
+      transfer.push(value.bytes);
+    }
+    return value;
+  } finally {
+    temps.forEach(ptr => Module._free(ptr));
+  }
+}
+
+self.onmessage = async ({ data }) => {
+  await ready;
+  const results = [], transfer = [];
+  for (const call of data.calls) {
+    try {
+      results.push({ id: call.id, value: runCall(call, transfer) });
+    } catch (err) {
+      results.push({ id: call.id, error: String(err && err.message || err) });
+    }
+  }
+  self.postMessage({ results }, transfer);
+};
@@ -1,284 +1,4014 @@
 #include "expense.h"
-#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <iomanip>
+#include <string_view>
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+// Text goes through JsonWriter, formatMoney and <charconv>, never iostreams or the printf
+// family, so the size-optimized WASM build (see expense-worker.js) links neither.
 
 using namespace std;
 
-static map<string, Group> groups;
-static map<string, int> groupCounters;
-static string jsonBuffer; // static buffer for returning strings safely
+// -------------- Group Registry ----------------
 
-static string jsonEscape(const string &s) {
-    string out;
-    for (char c : s) {
-        switch (c) {
-            case '\"': out += "\\\""; break;
-            case '\\': out += "\\\\"; break;
-            case '\n': out += "\\n"; break;
-            case '\r': out += "\\r"; break;
-            case '\t': out += "\\t"; break;
-            default: out += c;
+// Chunked object pool: objects never move once created, and destroyed slots are
+// recycled through an intrusive free list, so group churn stays off the allocator.
+template <typename T, size_t ChunkSize = 64>
+class Pool {
+public:
+    Pool() = default;
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    T* create() {
+        if (!freeList) grow();
+        Slot* s = freeList;
+        freeList = s->next;
+        return new (s->storage) T();
+    }
+
+    void destroy(T* obj) {
+        obj->~T();
+        Slot* s = reinterpret_cast<Slot*>(obj);
+        s->next = freeList;
+        freeList = s;
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    void grow() {
+        chunks.emplace_back(new Slot[ChunkSize]);
+        Slot* chunk = chunks.back().get();
+        for (size_t i = ChunkSize; i-- > 0;) {
+            chunk[i].next = freeList;
+            freeList = &chunk[i];
         }
     }
-    return out;
+
+    vector<unique_ptr<Slot[]>> chunks;
+    Slot* freeList = nullptr;
+};
+
+// Open-addressing hash table (linear probing, power-of-two capacity) from group
+// name to pool-allocated Group. One probe sequence per lookup; the stored hash
+// rejects most mismatches before any string compare.
+class GroupTable {
+public:
+    GroupTable() = default;
+    GroupTable(const GroupTable &) = delete;
+    GroupTable &operator=(const GroupTable &) = delete;
+    ~GroupTable() { clear(); }
+
+    Group* find(string_view name) const {
+        if (slots.empty()) return nullptr;
+        uint64_t h = hashName(name);
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            const Slot &s = slots[i];
+            if (s.state == EMPTY) return nullptr;
+            if (s.state == LIVE && s.hash == h && s.group->name == name) return s.group;
+        }
+    }
+
+    // Returns nullptr if a group with this name already exists.
+    Group* insert(string_view name) {
+        if ((count + tombstones + 1) * 4 > slots.size() * 3) rehash();
+        uint64_t h = hashName(name);
+        size_t target = SIZE_MAX;
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            Slot &s = slots[i];
+            if (s.state == EMPTY) {
+                if (target == SIZE_MAX) target = i;
+                break;
+            }
+            if (s.state == DELETED) {
+                if (target == SIZE_MAX) target = i;
+            } else if (s.hash == h && s.group->name == name) {
+                return nullptr;
+            }
+        }
+        Slot &s = slots[target];
+        if (s.state == DELETED) --tombstones;
+        s.state = LIVE;
+        s.hash = h;
+        s.group = pool.create();
+        s.group->name = name;
+        ++count;
+        return s.group;
+    }
+
+    bool erase(string_view name) {
+        if (slots.empty()) return false;
+        uint64_t h = hashName(name);
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            Slot &s = slots[i];
+            if (s.state == EMPTY) return false;
+            if (s.state == LIVE && s.hash == h && s.group->name == name) {
+                pool.destroy(s.group);
+                s.group = nullptr;
+                s.state = DELETED;
+                --count;
+                ++tombstones;
+                return true;
+            }
+        }
+    }
+
+    void clear() {
+        for (auto &s : slots)
+            if (s.state == LIVE) pool.destroy(s.group);
+        slots.clear();
+        count = tombstones = 0;
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (auto &s : slots)
+            if (s.state == LIVE) f(*s.group);
+    }
+
+    size_t size() const { return count; }
+
+private:
+    enum State : uint8_t { EMPTY, LIVE, DELETED };
+    struct Slot {
+        uint64_t hash = 0;
+        Group* group = nullptr;
+        State state = EMPTY;
+    };
+
+    static uint64_t hashName(string_view name) {
+        uint64_t h = 14695981039346656037ull; // FNV-1a
+        for (unsigned char c : name) h = (h ^ c) * 1099511628211ull;
+        return h;
+    }
+
+    size_t mask() const { return slots.size() - 1; }
+
+    void rehash() {
+        // Grow only when live entries need it; otherwise this just sweeps tombstones.
+        size_t cap = slots.empty() ? 16 : slots.size();
+        while ((count + 1) * 2 > cap) cap *= 2;
+        vector<Slot> old(cap);
+        old.swap(slots);
+        tombstones = 0;
+        for (auto &o : old) {
+            if (o.state != LIVE) continue;
+            size_t i = o.hash & mask();
+            while (slots[i].state != EMPTY) i = (i + 1) & mask();
+            slots[i] = o;
+        }
+    }
+
+    vector<Slot> slots;
+    size_t count = 0, tombstones = 0;
+    Pool<Group> pool;
+};
+
+// One independent engine instance. The table lock is taken shared to look groups up
+// and exclusively to add, remove or replace them; each group then has its own mutex
+// (Group::lock), so calls on different groups run in parallel.
+struct SsEngine {
+    GroupTable groups;
+    shared_mutex lock;
+
+    // Memory budget (setMemoryBudget). liveBytes sums Group::accountedBytes; once it
+    // passes budget the least recently used groups are evicted, into spilled as
+    // single-group snapshot blobs when spill is set. Spilled groups are reloaded on
+    // their next access by name. spilled and spilledBytes are guarded by lock.
+    atomic<size_t> budget{0}; // 0 = unlimited
+    bool spill = false;
+    atomic<int64_t> liveBytes{0};
+    atomic<uint64_t> useClock{0};
+    map<string, vector<unsigned char>, less<>> spilled;
+    size_t spilledBytes = 0;
+};
+
+static SsEngine defaultEngine; // behind the legacy, handle-less API
+
+// Per-thread result buffers: a returned pointer stays valid until the next call on the
+// same thread, and threads never overwrite each other's results.
+static thread_local string jsonBuffer;
+static thread_local vector<unsigned char> binBuffer; // binary exports, see getLastBinarySize
+
+// O(1) estimate of a group's heap footprint for the memory budget: container capacities
+// plus a flat allowance per map node, ignoring strings too long to store inline.
+// getEngineStats reports the slower, itemized groupMemoryBytes.
+static size_t approxGroupBytes(const Group &g) {
+    const size_t node = 4 * sizeof(void*);
+    return g.expenses.capacity() * (sizeof(Expense) + 3 * sizeof(uint32_t)) // + three posting entries
+         + g.slotById.capacity() * sizeof(int32_t)
+         + (g.shareMember.capacity() + g.equalMember.capacity()) * sizeof(uint32_t)
+         + g.shareAmount.capacity() * sizeof(Money)
+         + g.names.capacity() * sizeof(string) + g.nameIndex.heapBytes()
+         + g.currencies.capacity() * sizeof(Currency)
+         + (g.ledger.capacity() + g.paid.capacity()) * sizeof(Money)
+         + g.byDate.size() * (node + sizeof(string) + sizeof(vector<uint32_t>))
+         + g.byCategory.size() * (node + sizeof(string) + sizeof(vector<uint32_t>))
+         + g.categoryByMonth.size() * (node + 2 * sizeof(string) + sizeof(CategoryTotal))
+         + g.memberByMonth.size() * (node + sizeof(string) + sizeof(MemberSpend))
+         + g.idByDoc.size() * (node + sizeof(string))
+         + g.dupIndex.size() * node
+         + g.import.pending.capacity()
+         + g.settled.transfers.capacity() * sizeof(Transfer) + g.settled.json.capacity()
+         + g.checkpoints.dates.capacity() * sizeof(string) + g.checkpoints.rows.capacity() * sizeof(Money);
+}
+
+// Re-measures g after a call; caller holds g's lock.
+static void accountGroup(SsEngine &eng, Group &g) {
+    size_t now = approxGroupBytes(g);
+    eng.liveBytes += (int64_t)now - (int64_t)g.accountedBytes;
+    g.accountedBytes = now;
+}
+
+static bool overBudget(const SsEngine &eng) {
+    size_t budget = eng.budget.load(memory_order_relaxed);
+    return budget && eng.liveBytes.load(memory_order_relaxed) > (int64_t)budget;
+}
+
+// Defined under Memory Budget; both require eng.lock held exclusively.
+static void evictColdGroups(SsEngine &eng);
+static void reloadSpilled(SsEngine &eng, string_view name);
+
+// Finds a group and holds it for the caller: the table stays shared-locked so the group
+// cannot be removed, and the group's own mutex keeps other callers out. A spilled group
+// is reloaded first. On release the group is re-measured, and cold groups are evicted
+// if that leaves the engine over its memory budget.
+class GroupAccess {
+public:
+    GroupAccess(SsEngine &eng, string_view name) : eng(eng), tableLock(eng.lock), group(eng.groups.find(name)) {
+        while (!group && eng.spilled.find(name) != eng.spilled.end()) {
+            tableLock.unlock();
+            {
+                unique_lock<shared_mutex> reload(eng.lock);
+                reloadSpilled(eng, name);
+            }
+            tableLock.lock(); // an eviction may slip in between; then reload again
+            group = eng.groups.find(name);
+        }
+        if (!group) return;
+        hold = unique_lock<mutex>(group->lock.m);
+        group->lastUse = ++eng.useClock;
+    }
+    GroupAccess(const GroupAccess &) = delete;
+    GroupAccess &operator=(const GroupAccess &) = delete;
+    ~GroupAccess() {
+        if (!group) return;
+        accountGroup(eng, *group);
+        hold.unlock();
+        tableLock.unlock();
+        if (overBudget(eng)) {
+            unique_lock<shared_mutex> evict(eng.lock);
+            evictColdGroups(eng);
+        }
+    }
+    explicit operator bool() const { return group != nullptr; }
+    Group &operator*() const { return *group; }
+    Group* operator->() const { return group; }
+
+private:
+    SsEngine &eng;
+    shared_lock<shared_mutex> tableLock;
+    Group* group;
+    unique_lock<mutex> hold;
+};
+
+// -------------- Instrumentation ----------------
+
+// Built with -DSPENDSENSE_STATS, every export records its call count, a latency
+// histogram, the bytes it serialized and the heap allocations it made; getEngineStats
+// reports them. Otherwise STAT_SCOPE expands to nothing and the hot paths carry no cost.
+//
+// Allocations are counted by replacing the global operator new, on the calling thread
+// only (batch settlement workers are not attributed). Hosts that replace operator new
+// themselves, such as expense_bench, add -DSPENDSENSE_STATS_NO_ALLOC_HOOK.
+#ifdef SPENDSENSE_STATS
+
+#define SS_STAT_OPS(X) \
+    X(createGroup) X(createGroupPacked) X(listGroups) X(getGroupMembers) \
+    X(setGroupMembers) X(setGroupCurrencies) X(setDuplicatePolicy) X(findDuplicates) \
+    X(addGroupExpense) X(addGroupExpensePacked) X(loadGroupExpensesBatch) X(applyGroupOps) \
+    X(getGroupSyncState) X(editExpense) X(editExpensePacked) X(deleteExpense) \
+    X(deleteExpensePacked) X(showGroupExpenses) X(queryGroupExpenses) X(getSpendingSummary) \
+    X(beginGroupImport) X(feedGroupImport) X(finishGroupImport) X(exportGroupExpensesChunk) \
+    X(exportGroupExpensesColumnar) X(saveSnapshot) X(loadSnapshot) X(clearAllData) \
+    X(getGroupBalances) X(calculateGroupSettlement) X(calculateGroupSettlementWith) \
+    X(getGroupVersion) X(calculateSettlementAsOf) X(calculateSettlementsBatch) X(deleteGroup)
+
+enum StatOp {
+#define SS_STAT_ENUM(op) STAT_##op,
+    SS_STAT_OPS(SS_STAT_ENUM)
+#undef SS_STAT_ENUM
+    STAT_OP_COUNT
+};
+
+static const char* const STAT_OP_NAMES[STAT_OP_COUNT] = {
+#define SS_STAT_NAME(op) #op,
+    SS_STAT_OPS(SS_STAT_NAME)
+#undef SS_STAT_NAME
+};
+
+enum StatResult { STAT_JSON, STAT_BINARY, STAT_VOID };
+
+// Four latency buckets per power of two nanoseconds: a reported percentile is the upper
+// edge of its bucket, at most 25% above the true value.
+static const size_t LATENCY_BUCKETS = 4 * 44;
+
+struct OpStats {
+    atomic<uint64_t> calls{0}, totalNs{0}, resultBytes{0}, allocs{0};
+    atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+};
+
+static OpStats opStats[STAT_OP_COUNT];
+static thread_local uint64_t threadAllocs = 0; // operator new calls on this thread
+static thread_local int statDepth = 0;         // an export calling another counts once
+
+static size_t latencyBucket(uint64_t ns) {
+    if (ns < 4) return (size_t)ns;
+    int log = 63 - __builtin_clzll(ns);
+    size_t b = (size_t)log * 4 + ((ns >> (log - 2)) & 3);
+    return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+static uint64_t bucketUpperNs(size_t b) {
+    if (b < 4) return b + 1;
+    return (uint64_t)(5 + b % 4) << (b / 4 - 2);
+}
+
+class StatScope {
+public:
+    StatScope(StatOp op, StatResult result)
+        : op(op), result(result), outer(statDepth++ == 0), allocs(threadAllocs), start(chrono::steady_clock::now()) {}
+    StatScope(const StatScope &) = delete;
+    StatScope &operator=(const StatScope &) = delete;
+
+    // Runs after the export's return value is built, so the result buffers are final.
+    ~StatScope() {
+        --statDepth;
+        if (!outer) return;
+        uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        size_t bytes = result == STAT_JSON ? jsonBuffer.size() : result == STAT_BINARY ? binBuffer.size() : 0;
+        OpStats &s = opStats[op];
+        s.calls.fetch_add(1, memory_order_relaxed);
+        s.totalNs.fetch_add(ns, memory_order_relaxed);
+        s.resultBytes.fetch_add(bytes, memory_order_relaxed);
+        s.allocs.fetch_add(threadAllocs - allocs, memory_order_relaxed);
+        s.latency[latencyBucket(ns)].fetch_add(1, memory_order_relaxed);
+    }
+
+private:
+    StatOp op;
+    StatResult result;
+    bool outer;
+    uint64_t allocs;
+    chrono::steady_clock::time_point start;
+};
+
+#define STAT_SCOPE(op, result) StatScope statScope(STAT_##op, result)
+
+#ifndef SPENDSENSE_STATS_NO_ALLOC_HOOK
+// Kept out of line so the compiler does not pair the inlined malloc with a free it
+// cannot see matching (-Wmismatched-new-delete).
+__attribute__((noinline)) void* operator new(size_t n) {
+    ++threadAllocs;
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
 }
+__attribute__((noinline)) void* operator new(size_t n, const nothrow_t &) noexcept {
+    ++threadAllocs;
+    return malloc(n ? n : 1);
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+#else
+#define STAT_SCOPE(op, result) ((void)0)
+#endif
+
+// Appends JSON straight into a reused buffer (normally jsonBuffer). The buffer keeps
+// its capacity between calls, so steady-state exports make no heap allocations.
+class JsonWriter {
+public:
+    explicit JsonWriter(string &buf) : out(buf) { out.clear(); }
+
+    template <size_t N>
+    JsonWriter &raw(const char (&lit)[N]) { out.append(lit, N - 1); return *this; }
+    JsonWriter &raw(const char* s, size_t n) { out.append(s, n); return *this; }
+    JsonWriter &raw(char c) { out.push_back(c); return *this; }
 
-static vector<string> splitPipe(const string &s) {
-    vector<string> parts;
-    stringstream ss(s);
-    string token;
-    while (getline(ss, token, '|')) {
+    // Emits a comma before every element but the first.
+    JsonWriter &sep(bool &first) {
+        if (!first) out.push_back(',');
+        first = false;
+        return *this;
+    }
+
+    JsonWriter &str(const char* s, size_t n) {
+        out.push_back('"');
+        escape(s, n);
+        out.push_back('"');
+        return *this;
+    }
+    JsonWriter &str(string_view s) { return str(s.data(), s.size()); }
+
+    JsonWriter &uint(uint64_t v) {
+        char buf[24];
+        char* end = buf + sizeof buf;
+        char* p = end;
+        do { *--p = (char)('0' + v % 10); v /= 10; } while (v);
+        out.append(p, end - p);
+        return *this;
+    }
+
+    JsonWriter &money(Money v);
+
+    void reserve(size_t n) { out.reserve(n); }
+    const char* c_str() const { return out.c_str(); }
+
+private:
+    // Copies runs of plain bytes in one append and only breaks for characters JSON
+    // requires escaping.
+    void escape(const char* s, size_t n) {
+        static const char hex[] = "0123456789abcdef";
+        size_t run = 0;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = (unsigned char)s[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s + run, i - run);
+            run = i + 1;
+            switch (c) {
+                case '"': out.append("\\\"", 2); break;
+                case '\\': out.append("\\\\", 2); break;
+                case '\n': out.append("\\n", 2); break;
+                case '\r': out.append("\\r", 2); break;
+                case '\t': out.append("\\t", 2); break;
+                default: {
+                    char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    out.append(u, 6);
+                }
+            }
+        }
+        out.append(s + run, n - run);
+    }
+
+    string &out;
+};
+
+// Tokenizes a pipe-separated list in place, skipping empty tokens; the views point into s.
+static void splitPipe(string_view s, vector<string_view> &parts) {
+    parts.clear();
+    while (!s.empty()) {
+        size_t bar = s.find('|');
+        string_view token = s.substr(0, bar);
         if (!token.empty()) parts.push_back(token);
+        s.remove_prefix(bar == string_view::npos ? s.size() : bar + 1);
     }
-    return parts;
 }
 
-static string formatAmount(double v) {
-    stringstream ss;
-    ss << fixed << setprecision(2) << v;
-    return ss.str();
+// Looks a view up in a string-keyed unordered_map (no heterogeneous lookup before
+// C++20) through a per-thread key whose capacity is reused, so probes do not allocate.
+static const string &lookupKey(string_view s) {
+    static thread_local string key;
+    key.assign(s.data(), s.size());
+    return key;
+}
+
+// Converts an amount arriving as a JS number to minor units, rounding half away from
+// zero. NaN, infinities and anything outside the Money range are refused.
+static bool toMoney(double v, Money &out) {
+    double cents = v * 100.0;
+    if (!isfinite(cents) || fabs(cents) >= 9.2e18) return false;
+    out = (Money)llround(cents);
+    return true;
 }
 
-static bool approxEqual(double a, double b, double eps = 0.01) {
-    return fabs(a - b) <= eps;
+// Parses a decimal string such as "12", "-3.5" or "0.125" exactly into minor units;
+// digits past the second decimal round half away from zero.
+static bool parseMoney(string_view s, Money &out) {
+    size_t i = 0, n = s.size();
+    while (i < n && s[i] == ' ') ++i;
+    bool neg = false;
+    if (i < n && (s[i] == '-' || s[i] == '+')) neg = s[i++] == '-';
+    Money whole = 0, frac = 0;
+    int fracDigits = 0, digits = 0;
+    bool roundUp = false;
+    for (; i < n && s[i] >= '0' && s[i] <= '9'; ++i, ++digits) {
+        if (whole > (INT64_MAX / 100 - 9) / 10) return false;
+        whole = whole * 10 + (s[i] - '0');
+    }
+    if (i < n && s[i] == '.') {
+        for (++i; i < n && s[i] >= '0' && s[i] <= '9'; ++i, ++digits) {
+            if (fracDigits < 2) frac = frac * 10 + (s[i] - '0');
+            else if (fracDigits == 2) roundUp = s[i] >= '5';
+            ++fracDigits;
+        }
+    }
+    while (i < n && s[i] == ' ') ++i;
+    if (!digits || i != n) return false;
+    if (fracDigits == 1) frac *= 10;
+    Money v = whole * 100 + frac + (roundUp ? 1 : 0);
+    out = neg ? -v : v;
+    return true;
 }
 
-static bool validateMembersInGroup(const Group &g, const vector<string> &members) {
-    for (auto &m : members)
-        if (find(g.members.begin(), g.members.end(), m) == g.members.end())
-            return false;
+// Currency rates are fixed-point with RATE_DECIMALS decimals; see Currency.
+static const int RATE_DECIMALS = 6;
+static const int64_t RATE_SCALE = 1000000;
+static const int64_t RATE_MAX = RATE_SCALE * 1000000; // a million base units per unit
+
+// Parses a positive decimal such as "83.25" into a scaled rate; digits past the sixth
+// decimal round half up.
+static bool parseRate(string_view s, int64_t &out) {
+    size_t i = 0, n = s.size();
+    int64_t v = 0;
+    int fracDigits = -1, digits = 0;
+    bool roundUp = false;
+    for (; i < n; ++i) {
+        if (s[i] == '.' && fracDigits < 0) {
+            fracDigits = 0;
+            continue;
+        }
+        if (s[i] < '0' || s[i] > '9') return false;
+        ++digits;
+        if (fracDigits >= RATE_DECIMALS) {
+            if (fracDigits++ == RATE_DECIMALS) roundUp = s[i] >= '5';
+            continue;
+        }
+        if (v > RATE_MAX) return false;
+        v = v * 10 + (s[i] - '0');
+        if (fracDigits >= 0) ++fracDigits;
+    }
+    for (int d = max(fracDigits, 0); d < RATE_DECIMALS; ++d) {
+        if (v > RATE_MAX) return false;
+        v *= 10;
+    }
+    v += roundUp;
+    if (!digits || v <= 0 || v > RATE_MAX) return false;
+    out = v;
     return true;
 }
 
-static const char* makeJson(const string &msg) {
-    jsonBuffer = msg;
-    return jsonBuffer.c_str();
+static bool parseShares(string_view s, vector<Money> &out) {
+    while (!s.empty()) {
+        size_t bar = s.find('|');
+        string_view token = s.substr(0, bar);
+        s.remove_prefix(bar == string_view::npos ? s.size() : bar + 1);
+        Money v;
+        if (token.empty()) continue;
+        if (!parseMoney(token, v)) return false;
+        out.push_back(v);
+    }
+    return true;
 }
 
-// -------------- Group Management ----------------
+// Writes v as fixed two-decimal text ending just before end; returns the start.
+static char* formatMoney(Money v, char* end) {
+    char* p = end;
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    *--p = (char)('0' + u % 10); u /= 10;
+    *--p = (char)('0' + u % 10); u /= 10;
+    *--p = '.';
+    do { *--p = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) *--p = '-';
+    return p;
+}
 
-extern "C" const char* createGroup(const char* groupName, const char* members_str) {
-    string name(groupName);
-    string members(members_str);
+JsonWriter &JsonWriter::money(Money v) {
+    char buf[32];
+    char* p = formatMoney(v, buf + sizeof buf);
+    out.append(p, buf + sizeof buf - p);
+    return *this;
+}
 
-    if (name.empty()) return makeJson("{\"error\":\"Group name empty\"}");
-    if (groups.find(name) != groups.end())
-        return makeJson("{\"error\":\"Group already exists\"}");
+// Shares entered by hand may round differently from the total; allow one minor unit.
+static bool approxEqual(Money a, Money b, Money eps = 1) {
+    return llabs(a - b) <= eps;
+}
 
-    Group g;
-    g.name = name;
-    g.members = splitPipe(members);
-    groups[name] = g;
-    groupCounters[name] = 1;
+static uint8_t nameTag(string_view s) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (char c : s) h = (h ^ (uint8_t)c) * 16777619u;
+    return (uint8_t)(h ^ h >> 8 ^ h >> 16 ^ h >> 24);
+}
 
-    return makeJson("{\"ok\":true}");
+uint32_t NameIndex::find(const vector<string> &names, string_view key) const {
+    if (!isInline()) {
+        auto it = map.find(lookupKey(key));
+        return it != map.end() ? it->second : npos;
+    }
+    uint8_t tag = nameTag(key);
+    for (uint32_t i = 0; i < count; ++i)
+        if (tags[i] == tag && names[i] == key) return i;
+    return npos;
 }
 
-extern "C" const char* listGroups() {
-    stringstream ss;
-    ss << "[";
-    bool first = true;
-    for (auto &p : groups) {
-        if (!first) ss << ",";
-        ss << "{\"name\":\"" << jsonEscape(p.first) << "\"}";
-        first = false;
+void NameIndex::add(const vector<string> &names, uint32_t id) {
+    ++count;
+    if (count <= SPENDSENSE_INLINE_NAMES) {
+        tags[id] = nameTag(names[id]);
+        return;
+    }
+    if (map.empty()) {
+        map.reserve(count * 2);
+        for (uint32_t i = 0; i < id; ++i) map.emplace(names[i], i);
     }
-    ss << "]";
-    return makeJson(ss.str());
+    map.emplace(names[id], id);
 }
 
-extern "C" const char* getGroupMembers(const char* groupName) {
-    string name(groupName);
-    auto it = groups.find(name);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
+size_t NameIndex::heapBytes() const {
+    if (isInline()) return 0;
+    return map.bucket_count() * sizeof(void*) + map.size() * (2 * sizeof(void*) + sizeof(*map.begin()));
+}
 
-    stringstream ss;
-    ss << "[";
-    bool first = true;
-    for (auto &m : it->second.members) {
-        if (!first) ss << ",";
-        ss << "\"" << jsonEscape(m) << "\"";
-        first = false;
+static uint32_t internName(Group &g, string_view name) {
+    uint32_t found = g.nameIndex.find(g.names, name);
+    if (found != NameIndex::npos) return found;
+    uint32_t id = (uint32_t)g.names.size();
+    g.names.emplace_back(name);
+    g.nameIndex.add(g.names, id);
+    g.ledger.push_back(0);
+    g.paid.push_back(0);
+    return id;
+}
+
+static bool validateMembersInGroup(const Group &g, const vector<string_view> &members, vector<uint32_t> &ids) {
+    ids.clear();
+    ids.reserve(members.size());
+    for (auto m : members) {
+        uint32_t id = g.nameIndex.find(g.names, m);
+        if (id >= g.rosterSize) return false; // also npos
+        ids.push_back(id);
     }
-    ss << "]";
-    return makeJson(ss.str());
+    return true;
 }
 
-// -------------- Expense Management ----------------
+// Expense fields as they arrive over the C API, before names are resolved to ids. Only
+// the fields an Expense stores are copied; payer and members view the caller's input.
+struct ExpenseInput {
+    string name, category, date;
+    string_view payer;
+    Money amount = 0;
+    vector<string_view> members;
+    vector<Money> shares; // empty means an equal split
+    string_view currency; // code in Group::currencies; empty means the base
+    const char* invalid = nullptr; // set by a reader for a value that parsed but is unusable
+};
 
-extern "C" const char* addGroupExpense(const char* groupName, const char* name, const char* category,
-                                       double amount, const char* payer, const char* members_str,
-                                       const char* shares_str, const char* date) {
-    string gname(groupName);
-    auto it = groups.find(gname);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
-    Group &g = it->second;
+static atomic<uint32_t> versionEpoch{0};
 
-    Expense e;
-    e.id = to_string(groupCounters[gname]++);
-    e.name = name;
-    e.category = category;
-    e.amount = amount;
-    e.payer = payer;
-    e.date = date;
-    e.members = splitPipe(members_str);
-
-    if (e.members.empty()) return makeJson("{\"error\":\"Members empty\"}");
-    if (!validateMembersInGroup(g, e.members))
-        return makeJson("{\"error\":\"Invalid member(s)\"}");
-
-    vector<string> shareTokens = splitPipe(shares_str);
-    if (!shareTokens.empty()) {
-        for (auto &t : shareTokens) e.shares.push_back(stod(t));
-        if (e.shares.size() != e.members.size())
-            return makeJson("{\"error\":\"Share count mismatch\"}");
+// First Group::version of a group just created or loaded.
+static uint64_t freshVersion() {
+    return (uint64_t)(versionEpoch.fetch_add(1, memory_order_relaxed) + 1) << 32;
+}
+
+// Share of member i in an even split of amount over n members: exact, with the first
+// |remainder| members carrying one extra minor unit so the shares always sum to amount.
+static Money equalShare(Money amount, uint32_t n, uint32_t i) {
+    Money rem = amount % n;
+    return amount / n + ((Money)i < llabs(rem) ? (rem < 0 ? -1 : 1) : 0);
+}
+
+// v * rate / RATE_SCALE rounded half away from zero. |v| <= INT64_MAX and rate <=
+// RATE_MAX keep the product well inside 128 bits.
+static __int128 convertScaled(__int128 v, int64_t rate) {
+    __int128 p = v * rate;
+    return (p < 0 ? p - RATE_SCALE / 2 : p + RATE_SCALE / 2) / RATE_SCALE;
+}
+
+// Converts in's amount and shares from in.currency into g's base currency in place and
+// returns the currency's index, or sets err. Each share is the difference of converted
+// running totals, so converted shares that summed to the amount still do.
+static uint16_t toBaseCurrency(const Group &g, ExpenseInput &in, const char* &err) {
+    err = nullptr;
+    if (in.currency.empty()) return 0;
+    size_t c = 0;
+    while (c < g.currencies.size() && g.currencies[c].code != in.currency) ++c;
+    if (c == g.currencies.size()) {
+        err = "Unknown currency";
+        return 0;
+    }
+    if (c == 0) return 0;
+
+    const int64_t rate = g.currencies[c].rate;
+    auto inRange = [](__int128 v) { return v >= INT64_MIN && v <= INT64_MAX; };
+    __int128 amount = convertScaled(in.amount, rate), sum = 0, converted = 0;
+    bool ok = inRange(amount);
+    for (size_t i = 0; i < in.shares.size() && ok; ++i) {
+        sum += in.shares[i];
+        __int128 next = convertScaled(sum, rate);
+        ok = inRange(sum) && inRange(next - converted);
+        in.shares[i] = (Money)(next - converted);
+        converted = next;
+    }
+    if (!ok) {
+        err = "Amount out of range";
+        return 0;
+    }
+    in.amount = (Money)amount;
+    return (uint16_t)c;
+}
+
+// Appends e's split rows for the given name ids. No shares, or shares identical to the
+// even split, take the compact equal-split form with no amount rows.
+static void appendSplit(Group &g, Expense &e, const vector<uint32_t> &ids, const vector<Money> &shares) {
+    e.shareCount = (uint32_t)ids.size();
+    e.equalSplit = true;
+    for (uint32_t i = 0; i < shares.size() && e.equalSplit; ++i)
+        e.equalSplit = shares[i] == equalShare(e.amount, e.shareCount, i);
+    if (e.equalSplit) {
+        e.shareBegin = (uint32_t)g.equalMember.size();
+        g.equalMember.insert(g.equalMember.end(), ids.begin(), ids.end());
     } else {
-        double equal = amount / (double)e.members.size();
-        e.shares.assign(e.members.size(), equal);
+        e.shareBegin = (uint32_t)g.shareMember.size();
+        g.shareMember.insert(g.shareMember.end(), ids.begin(), ids.end());
+        g.shareAmount.insert(g.shareAmount.end(), shares.begin(), shares.end());
     }
+}
+
+// Id of a live expense other than e (payer, shareCount and scalar fields set, split not
+// yet appended; ids are its members) that e duplicates, or 0. Needs the index on.
+static uint32_t findDuplicate(const Group &g, const Expense &e, const vector<uint32_t> &ids);
 
-    double total = 0; for (auto s : e.shares) total += s;
-    if (!approxEqual(total, amount)) {
-        stringstream ss;
-        ss << "{\"ok\":true,\"warning\":\"Shares (" << formatAmount(total)
-           << ") != Amount (" << formatAmount(amount) << ")\"}";
-        g.expenses.push_back(e);
-        return makeJson(ss.str());
+// Shared validation for single and batch ingest. Fills e (all but id) from in,
+// moving its strings and appending its split rows, and returns an error message or
+// nullptr. Nothing is appended or interned when validation fails. With dupOf (new
+// expenses only; the caller zeroes it) g's duplicate policy applies too: *dupOf gets
+// the id of a live expense e duplicates, and DUP_REJECT fails with "Duplicate expense".
+static const char* buildExpense(Group &g, ExpenseInput &in, Expense &e, uint32_t* dupOf = nullptr) {
+    static thread_local vector<uint32_t> ids;
+    if (in.invalid) return in.invalid;
+    if (in.members.empty()) return "Members empty";
+    if (!validateMembersInGroup(g, in.members, ids)) return "Invalid member(s)";
+    if (!in.shares.empty() && in.shares.size() != in.members.size()) return "Share count mismatch";
+    const char* err;
+    Money original = in.amount;
+    e.currency = toBaseCurrency(g, in, err);
+    if (err) return err;
+    if (e.currency) e.original = original;
+
+    e.name = std::move(in.name);
+    e.category = std::move(in.category);
+    e.amount = in.amount;
+    e.date = std::move(in.date);
+    if (dupOf && g.dupPolicy != DUP_OFF) {
+        // Only a payer the group knows can match.
+        e.payer = g.nameIndex.find(g.names, in.payer);
+        e.shareCount = (uint32_t)ids.size();
+        *dupOf = e.payer == NameIndex::npos ? 0 : findDuplicate(g, e, ids);
+        if (*dupOf && g.dupPolicy == DUP_REJECT) return "Duplicate expense";
     }
+    e.payer = internName(g, in.payer);
+    appendSplit(g, e, ids, in.shares);
+    return nullptr;
+}
 
-    g.expenses.push_back(e);
-    return makeJson("{\"ok\":true}");
+static Money sharesTotal(const Group &g, const Expense &e) {
+    if (e.equalSplit) return e.amount;
+    Money total = 0;
+    for (uint32_t k = e.shareBegin; k < e.shareBegin + e.shareCount; ++k) total += g.shareAmount[k];
+    return total;
 }
 
-extern "C" const char* editExpense(const char* groupName, const char* expenseId,
-                                   const char* name, const char* category, double amount,
-                                   const char* payer, const char* members_str,
-                                   const char* shares_str, const char* date) {
-    string gname(groupName);
-    auto it = groups.find(gname);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
-    Group &g = it->second;
+// Calls fn(nameId, share) for each member of e's split, in the order they were given.
+template <typename Fn>
+static void forEachShare(const Group &g, const Expense &e, Fn fn) {
+    if (e.equalSplit) {
+        const uint32_t* member = g.equalMember.data() + e.shareBegin;
+        for (uint32_t i = 0; i < e.shareCount; ++i) fn(member[i], equalShare(e.amount, e.shareCount, i));
+    } else {
+        for (uint32_t k = e.shareBegin; k < e.shareBegin + e.shareCount; ++k) fn(g.shareMember[k], g.shareAmount[k]);
+    }
+}
 
-    for (auto &e : g.expenses) {
-        if (e.id == expenseId) {
-            e.name = name;
-            e.category = category;
-            e.amount = amount;
-            e.payer = payer;
-            e.date = date;
-            e.members = splitPipe(members_str);
-            e.shares.clear();
-
-            vector<string> shareTokens = splitPipe(shares_str);
-            if (!shareTokens.empty()) {
-                for (auto &t : shareTokens) e.shares.push_back(stod(t));
-                if (e.shares.size() != e.members.size())
-                    return makeJson("{\"error\":\"Share count mismatch\"}");
-            } else {
-                double equal = amount / (double)e.members.size();
-                e.shares.assign(e.members.size(), equal);
-            }
-            return makeJson("{\"ok\":true}");
+// Zeroes the rows of an expense that is going away; they no longer count anywhere.
+static void releaseShares(Group &g, const Expense &e) {
+    if (!e.equalSplit) fill_n(g.shareAmount.begin() + e.shareBegin, e.shareCount, 0);
+    g.deadShareRows += e.shareCount;
+}
+
+// Adds (sign = 1) or retracts (sign = -1) an expense's effect on the group ledger.
+static void applyToLedger(Group &g, const Expense &e, Money sign) {
+    ++g.version;
+    forEachShare(g, e, [&](uint32_t id, Money share) { g.ledger[id] -= sign * share; });
+    g.ledger[e.payer] += sign * e.amount;
+    g.paid[e.payer] += sign * e.amount;
+}
+
+// Adds amount[k] into out[member[k]] for every row. Rosters of up to KERNEL_LANES_ROSTER
+// names compare each block of rows against every member id and add under the mask,
+// which avoids scattered stores (and the store-to-load stalls of consecutive rows
+// hitting one member); this is the SIMD path. Larger rosters scatter into four
+// interleaved partial histograms so back-to-back updates of one slot do not serialize.
+static const uint32_t KERNEL_LANES_ROSTER = 8;
+
+static void accumulateSmallRoster(const uint32_t* member, const Money* amount, size_t n, Money* out) {
+    Money acc[KERNEL_LANES_ROSTER] = {};
+    size_t k = 0;
+#if defined(__AVX2__)
+    __m256i lanes[KERNEL_LANES_ROSTER];
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) lanes[r] = _mm256_setzero_si256();
+    for (; k + 4 <= n; k += 4) {
+        __m256i ids = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(member + k)));
+        __m256i amt = _mm256_loadu_si256((const __m256i*)(amount + k));
+        for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) {
+            __m256i hit = _mm256_cmpeq_epi64(ids, _mm256_set1_epi64x(r));
+            lanes[r] = _mm256_add_epi64(lanes[r], _mm256_and_si256(hit, amt));
+        }
+    }
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) {
+        alignas(32) Money part[4];
+        _mm256_store_si256((__m256i*)part, lanes[r]);
+        acc[r] = part[0] + part[1] + part[2] + part[3];
+    }
+#elif defined(__SSE2__)
+    __m128i lanes[KERNEL_LANES_ROSTER];
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) lanes[r] = _mm_setzero_si128();
+    for (; k + 2 <= n; k += 2) {
+        // SSE2 has no 64-bit compare: compare 32-bit halves and require both to match.
+        __m128i ids = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i*)(member + k)), _mm_setzero_si128());
+        __m128i amt = _mm_loadu_si128((const __m128i*)(amount + k));
+        for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) {
+            __m128i eq = _mm_cmpeq_epi32(ids, _mm_set1_epi64x(r));
+            __m128i hit = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+            lanes[r] = _mm_add_epi64(lanes[r], _mm_and_si128(hit, amt));
         }
     }
-    return makeJson("{\"error\":\"Expense not found\"}");
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) {
+        alignas(16) Money part[2];
+        _mm_store_si128((__m128i*)part, lanes[r]);
+        acc[r] = part[0] + part[1];
+    }
+#elif defined(__wasm_simd128__)
+    v128_t lanes[KERNEL_LANES_ROSTER];
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) lanes[r] = wasm_i64x2_splat(0);
+    for (; k + 2 <= n; k += 2) {
+        v128_t ids = wasm_u64x2_load32x2(member + k);
+        v128_t amt = wasm_v128_load(amount + k);
+        for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) {
+            v128_t hit = wasm_i64x2_eq(ids, wasm_i64x2_splat(r));
+            lanes[r] = wasm_i64x2_add(lanes[r], wasm_v128_and(hit, amt));
+        }
+    }
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r)
+        acc[r] = wasm_i64x2_extract_lane(lanes[r], 0) + wasm_i64x2_extract_lane(lanes[r], 1);
+#endif
+    for (; k < n; ++k) acc[member[k]] += amount[k];
+    for (uint32_t r = 0; r < KERNEL_LANES_ROSTER; ++r) out[r] += acc[r];
 }
 
-extern "C" const char* deleteExpense(const char* groupName, const char* expenseId) {
-    string gname(groupName);
-    auto it = groups.find(gname);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
-    Group &g = it->second;
+static void accumulateShares(const uint32_t* member, const Money* amount, size_t n, Money* out, size_t names) {
+    if (names <= KERNEL_LANES_ROSTER) {
+        Money padded[KERNEL_LANES_ROSTER] = {};
+        accumulateSmallRoster(member, amount, n, padded);
+        for (size_t r = 0; r < names; ++r) out[r] += padded[r];
+        return;
+    }
+    if (n < 4 * names) {
+        for (size_t k = 0; k < n; ++k) out[member[k]] += amount[k];
+        return;
+    }
+    static thread_local vector<Money> parts;
+    parts.assign(4 * names, 0);
+    Money* p0 = parts.data();
+    Money* p1 = p0 + names;
+    Money* p2 = p1 + names;
+    Money* p3 = p2 + names;
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        p0[member[k]] += amount[k];
+        p1[member[k + 1]] += amount[k + 1];
+        p2[member[k + 2]] += amount[k + 2];
+        p3[member[k + 3]] += amount[k + 3];
+    }
+    for (; k < n; ++k) p0[member[k]] += amount[k];
+    for (size_t r = 0; r < names; ++r) out[r] += p0[r] + p1[r] + p2[r] + p3[r];
+}
 
-    auto &vec = g.expenses;
-    auto rem = remove_if(vec.begin(), vec.end(), [&](const Expense &e){ return e.id == expenseId; });
-    if (rem == vec.end()) return makeJson("{\"error\":\"Expense not found\"}");
+// Ledger effect of expenses[firstExpense..] and custom share rows [firstRow..) in one
+// pass, for bulk loads; equivalent to applyToLedger(+1) on each of those expenses.
+static void applyRangeToLedger(Group &g, size_t firstExpense, size_t firstRow) {
+    static thread_local vector<Money> owed;
+    ++g.version;
+    owed.assign(g.names.size(), 0);
+    for (size_t i = firstExpense; i < g.expenses.size(); ++i) {
+        const Expense &e = g.expenses[i];
+        g.ledger[e.payer] += e.amount;
+        g.paid[e.payer] += e.amount;
+        if (!e.equalSplit) continue;
+        const uint32_t* member = g.equalMember.data() + e.shareBegin;
+        Money each = e.amount / e.shareCount, rem = e.amount % e.shareCount;
+        for (uint32_t k = 0; k < e.shareCount; ++k) owed[member[k]] += each;
+        for (Money k = 0; k < llabs(rem); ++k) owed[member[k]] += rem < 0 ? -1 : 1;
+    }
+    accumulateShares(g.shareMember.data() + firstRow, g.shareAmount.data() + firstRow,
+                     g.shareMember.size() - firstRow, owed.data(), owed.size());
+    for (size_t k = 0; k < owed.size(); ++k) g.ledger[k] -= owed[k];
+}
 
-    vec.erase(rem, vec.end());
-    return makeJson("{\"ok\":true}");
+static void insertPosting(vector<uint32_t> &list, uint32_t id) {
+    // Ids are handed out in increasing order, so adds almost always append.
+    if (list.empty() || list.back() < id) list.push_back(id);
+    else list.insert(lower_bound(list.begin(), list.end(), id), id);
 }
 
-extern "C" const char* showGroupExpenses(const char* groupName) {
-    string gname(groupName);
-    auto it = groups.find(gname);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
-    Group &g = it->second;
+template <typename Index, typename Key>
+static void erasePosting(Index &index, const Key &key, uint32_t id) {
+    auto it = index.find(key);
+    if (it == index.end()) return;
+    auto &list = it->second;
+    auto pos = lower_bound(list.begin(), list.end(), id);
+    if (pos != list.end() && *pos == id) list.erase(pos);
+    if (list.empty()) index.erase(it);
+}
 
-    stringstream ss;
-    ss << "{\"group\":\"" << jsonEscape(gname) << "\",\"expenses\":[";
-    bool first = true;
-    for (auto &e : g.expenses) {
-        if (!first) ss << ",";
-        ss << "{";
-        ss << "\"id\":\"" << e.id << "\",";
-        ss << "\"name\":\"" << jsonEscape(e.name) << "\",";
-        ss << "\"category\":\"" << jsonEscape(e.category) << "\",";
-        ss << "\"amount\":" << formatAmount(e.amount) << ",";
-        ss << "\"payer\":\"" << jsonEscape(e.payer) << "\",";
-        ss << "\"members\":[";
-        for (size_t i = 0; i < e.members.size(); ++i) {
-            if (i) ss << ",";
-            ss << "\"" << jsonEscape(e.members[i]) << "\"";
-        }
-        ss << "],\"shares\":[";
-        for (size_t i = 0; i < e.shares.size(); ++i) {
-            if (i) ss << ",";
-            ss << formatAmount(e.shares[i]);
-        }
-        ss << "],\"date\":\"" << jsonEscape(e.date) << "\"}";
-        first = false;
+// map::emplace builds a node even when the key exists; look up first so hits stay allocation-free.
+template <typename Map>
+static typename Map::iterator rollupBucket(Map &m, typename Map::key_type &&key) {
+    auto it = m.lower_bound(key);
+    if (it == m.end() || m.key_comp()(key, it->first))
+        it = m.emplace_hint(it, std::move(key), typename Map::mapped_type());
+    return it;
+}
+
+static void applyToRollups(Group &g, const Expense &e, Money sign) {
+    string month = e.date.substr(0, 7);
+
+    auto cat = rollupBucket(g.categoryByMonth, make_pair(month, e.category));
+    cat->second.total += sign * e.amount;
+    cat->second.count += sign;
+    if (cat->second.count == 0) g.categoryByMonth.erase(cat);
+
+    auto touch = [&](uint32_t id, Money paid, Money share) {
+        auto it = rollupBucket(g.memberByMonth, make_pair(month, id));
+        it->second.paid += sign * paid;
+        it->second.share += sign * share;
+        it->second.count += sign;
+        if (it->second.count == 0) g.memberByMonth.erase(it);
+    };
+    touch(e.payer, e.amount, 0);
+    forEachShare(g, e, [&](uint32_t id, Money share) { touch(id, 0, share); });
+}
+
+// Everything trackExpense maintains except the ledger, for bulk paths that settle the
+// ledger afterwards with applyRangeToLedger.
+static uint64_t mix64(uint64_t x) { // splitmix64 finalizer
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t memberHash(uint32_t id) {
+    return mix64(id + 0x9e3779b97f4a7c15ull);
+}
+
+// Hash of the fields sameSpend compares, given the sum of memberHash over e's members
+// (a sum, so their order does not matter).
+static uint64_t fingerprint(const Expense &e, uint64_t members) {
+    uint64_t h = hash<string_view>()(e.name) ^ mix64(hash<string_view>()(e.date));
+    h = mix64(h ^ ((uint64_t)e.payer << 32 | e.shareCount)) ^ mix64((uint64_t)e.amount + e.currency);
+    return mix64(h + members);
+}
+
+static uint64_t expenseFingerprint(const Group &g, const Expense &e) {
+    uint64_t members = 0;
+    forEachShare(g, e, [&](uint32_t id, Money) { members += memberHash(id); });
+    return fingerprint(e, members);
+}
+
+static void sortedMembers(const Group &g, const Expense &e, vector<uint32_t> &out) {
+    out.clear();
+    forEachShare(g, e, [&](uint32_t id, Money) { out.push_back(id); });
+    sort(out.begin(), out.end());
+}
+
+// Whether other records the same spend as e, whose sorted member ids are members:
+// payer, amount as entered, date, name and the same members in any order. Categories
+// and custom shares may differ.
+static bool sameSpend(const Group &g, const Expense &e, const vector<uint32_t> &members, const Expense &other) {
+    static thread_local vector<uint32_t> theirs;
+    if (e.payer != other.payer || e.amount != other.amount || e.currency != other.currency ||
+        e.original != other.original || members.size() != other.shareCount || e.date != other.date ||
+        e.name != other.name) return false;
+    sortedMembers(g, other, theirs);
+    return theirs == members;
+}
+
+static void indexFingerprint(Group &g, const Expense &e, Money sign) {
+    uint64_t fp = expenseFingerprint(g, e);
+    if (sign > 0) {
+        g.dupIndex.emplace(fp, e.id);
+        return;
+    }
+    auto range = g.dupIndex.equal_range(fp);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == e.id) {
+            g.dupIndex.erase(it);
+            return;
+        }
     }
-    ss << "]}";
-    return makeJson(ss.str());
 }
 
-extern "C" const char* calculateGroupSettlement(const char* groupName) {
-    string gname(groupName);
-    auto it = groups.find(gname);
-    if (it == groups.end()) return makeJson("{\"error\":\"Group not found\"}");
-    Group &g = it->second;
+static uint32_t findDuplicate(const Group &g, const Expense &e, const vector<uint32_t> &ids) {
+    static thread_local vector<uint32_t> members;
+    uint64_t sum = 0;
+    for (uint32_t id : ids) sum += memberHash(id);
+    auto range = g.dupIndex.equal_range(fingerprint(e, sum));
+    if (range.first == range.second) return 0;
+    members.assign(ids.begin(), ids.end());
+    sort(members.begin(), members.end());
+    for (auto it = range.first; it != range.second; ++it) {
+        const Expense &other = g.expenses[g.slotById[it->second]];
+        if (other.id != e.id && sameSpend(g, e, members, other)) return other.id;
+    }
+    return 0;
+}
+
+// Drops the as-of checkpoint rows that cover date; ledgerCheckpoints extends the table
+// again from the last row left.
+static void invalidateCheckpoints(LedgerCheckpoints &c, string_view date) {
+    size_t keep = lower_bound(c.dates.begin(), c.dates.end(), date) - c.dates.begin();
+    if (keep == c.dates.size()) return;
+    c.dates.resize(keep);
+    c.rows.resize(keep * c.width);
+}
+
+static void indexExpense(Group &g, const Expense &e, Money sign) {
+    invalidateCheckpoints(g.checkpoints, e.date);
+    applyToRollups(g, e, sign);
+    if (g.dupPolicy != DUP_OFF) indexFingerprint(g, e, sign);
+    if (sign > 0) {
+        insertPosting(g.byDate[e.date], e.id);
+        insertPosting(g.byCategory[e.category], e.id);
+        if (g.byPayer.size() <= e.payer) g.byPayer.resize(e.payer + 1);
+        insertPosting(g.byPayer[e.payer], e.id);
+    } else {
+        erasePosting(g.byDate, e.date, e.id);
+        erasePosting(g.byCategory, e.category, e.id);
+        auto &list = g.byPayer[e.payer];
+        auto pos = lower_bound(list.begin(), list.end(), e.id);
+        if (pos != list.end() && *pos == e.id) list.erase(pos);
+    }
+}
+
+// Single hook for everything derived from the live expense set: call with
+// sign = 1 once an expense is live and sign = -1 before it changes or goes away.
+static void trackExpense(Group &g, const Expense &e, Money sign) {
+    applyToLedger(g, e, sign);
+    indexExpense(g, e, sign);
+}
+
+static void appendExpense(Group &g, Expense &&e) {
+    if (g.slotById.size() <= e.id) g.slotById.resize(e.id + 1, -1);
+    g.slotById[e.id] = (int32_t)g.expenses.size();
+    g.expenses.push_back(std::move(e));
+}
 
-    map<string, double> balance;
-    for (auto &m : g.members) balance[m] = 0.0;
+static Expense* findExpense(Group &g, string_view expenseId) {
+    uint32_t id;
+    const char* end = expenseId.data() + expenseId.size();
+    auto parsed = from_chars(expenseId.data(), end, id);
+    if (parsed.ec != errc() || parsed.ptr != end || id >= g.slotById.size() || g.slotById[id] < 0) return nullptr;
+    return &g.expenses[g.slotById[id]];
+}
 
+// Rewrites the share columns with only live expenses' rows, in expense order.
+static void compactShares(Group &g) {
+    vector<uint32_t> member, equal;
+    vector<Money> amount;
     for (auto &e : g.expenses) {
-        for (size_t i = 0; i < e.members.size(); ++i)
-            balance[e.members[i]] -= e.shares[i];
-        balance[e.payer] += e.amount;
+        if (!e.live) continue;
+        auto from = (e.equalSplit ? g.equalMember : g.shareMember).begin() + e.shareBegin;
+        vector<uint32_t> &to = e.equalSplit ? equal : member;
+        uint32_t begin = (uint32_t)to.size();
+        to.insert(to.end(), from, from + e.shareCount);
+        if (!e.equalSplit)
+            amount.insert(amount.end(), g.shareAmount.begin() + e.shareBegin, g.shareAmount.begin() + e.shareBegin + e.shareCount);
+        e.shareBegin = begin;
     }
+    g.shareMember.swap(member);
+    g.shareAmount.swap(amount);
+    g.equalMember.swap(equal);
+    g.deadShareRows = 0;
+}
 
-    vector<pair<string, double>> debtors, creditors;
-    for (auto &b : balance) {
-        if (b.second < -0.005) debtors.push_back({b.first, -b.second});
-        else if (b.second > 0.005) creditors.push_back({b.first, b.second});
-    }
+// Edits leave dead rows behind without a tombstone; reclaim them on the same terms.
+static void maybeCompactShares(Group &g) {
+    size_t rows = g.shareMember.size() + g.equalMember.size();
+    if (g.deadShareRows >= 1024 && g.deadShareRows * 2 >= rows) compactShares(g);
+}
 
-    size_t i = 0, j = 0;
-    vector<tuple<string, string, double>> settlements;
-    while (i < debtors.size() && j < creditors.size()) {
-        double pay = min(debtors[i].second, creditors[j].second);
-        if (pay > 0.005)
-            settlements.push_back({debtors[i].first, creditors[j].first, pay});
-        debtors[i].second -= pay;
-        creditors[j].second -= pay;
-        if (debtors[i].second <= 0.005) ++i;
-        if (creditors[j].second <= 0.005) ++j;
+// Drops tombstones once they make up half the vector, keeping insertion order,
+// so deletes stay O(1) amortized and readers never walk mostly-dead storage.
+static void maybeCompact(Group &g) {
+    if (g.tombstones < 64 || g.tombstones * 2 < g.expenses.size()) return;
+    size_t out = 0;
+    for (size_t i = 0; i < g.expenses.size(); ++i) {
+        if (!g.expenses[i].live) continue;
+        if (out != i) g.expenses[out] = std::move(g.expenses[i]);
+        g.slotById[g.expenses[out].id] = (int32_t)out;
+        ++out;
     }
+    g.expenses.resize(out);
+    g.tombstones = 0;
+    compactShares(g);
+}
 
-    stringstream ss;
-    ss << "{\"group\":\"" << jsonEscape(gname) << "\",\"settlements\":[";
+// Turns e into a tombstone; e may be moved by the compaction this can trigger.
+static void removeExpense(Group &g, Expense &e) {
+    trackExpense(g, e, -1);
+    releaseShares(g, e);
+    g.slotById[e.id] = -1;
+    e = Expense();
+    e.live = false;
+    ++g.tombstones;
+    maybeCompact(g);
+}
+
+// Swaps in a validated replacement built by buildExpense, keeping current's id and slot.
+static void replaceExpense(Group &g, Expense &current, Expense &&updated) {
+    updated.id = current.id;
+    trackExpense(g, current, -1);
+    trackExpense(g, updated, 1);
+    releaseShares(g, current);
+    current = std::move(updated);
+    maybeCompactShares(g);
+}
+
+static const char* makeJson(const char* msg) {
+    jsonBuffer = msg;
+    return jsonBuffer.c_str();
+}
+
+static const char* errorJson(const char* err) {
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"error\":").str(err, strlen(err)).raw('}');
+    return w.c_str();
+}
+
+// -------------- Group Management ----------------
+
+// members may contain empty names, which are skipped.
+static const char* createGroupWith(SsEngine &eng, string_view groupName, const vector<string_view> &members) {
+    if (groupName.empty()) return makeJson("{\"error\":\"Group name empty\"}");
+    unique_lock<shared_mutex> tableLock(eng.lock);
+    Group* created = eng.spilled.count(groupName) ? nullptr : eng.groups.insert(groupName);
+    if (!created) return makeJson("{\"error\":\"Group already exists\"}");
+
+    Group &g = *created;
+    for (auto m : members) if (!m.empty()) g.members.emplace_back(m);
+    for (auto &m : g.members) internName(g, m);
+    g.rosterSize = (uint32_t)g.names.size();
+    g.version = freshVersion();
+    g.lastUse = ++eng.useClock;
+    accountGroup(eng, g);
+    evictColdGroups(eng);
+
+    return makeJson("{\"ok\":true}");
+}
+
+static const char* createGroupIn(SsEngine &eng, string_view groupName, string_view members_str) {
+    STAT_SCOPE(createGroup, STAT_JSON);
+    vector<string_view> members;
+    splitPipe(members_str, members);
+    return createGroupWith(eng, groupName, members);
+}
+
+static const char* listGroupsIn(SsEngine &eng) {
+    STAT_SCOPE(listGroups, STAT_JSON);
+    // The table is unordered; sort so the listing stays alphabetical. Spilled groups
+    // still exist as far as callers are concerned.
+    vector<const string*> names;
+    shared_lock<shared_mutex> tableLock(eng.lock);
+    names.reserve(eng.groups.size() + eng.spilled.size());
+    eng.groups.forEach([&](const Group &g) { names.push_back(&g.name); });
+    for (auto &s : eng.spilled) names.push_back(&s.first);
+    sort(names.begin(), names.end(), [](const string* a, const string* b) { return *a < *b; });
+
+    JsonWriter w(jsonBuffer);
+    w.raw('[');
     bool first = true;
-    for (auto &t : settlements) {
-        if (!first) ss << ",";
-        ss << "{\"from\":\"" << get<0>(t) << "\",\"to\":\"" << get<1>(t)
-           << "\",\"amount\":" << formatAmount(get<2>(t)) << "}";
-        first = false;
+    for (auto* n : names) w.sep(first).raw("{\"name\":").str(*n).raw('}');
+    w.raw(']');
+    return w.c_str();
+}
+
+static const char* getGroupMembersIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(getGroupMembers, STAT_JSON);
+    GroupAccess g(eng, groupName);
+    if (!g) return makeJson("{\"error\":\"Group not found\"}");
+
+    JsonWriter w(jsonBuffer);
+    w.raw('[');
+    bool first = true;
+    for (auto &m : g->members) w.sep(first).str(m);
+    w.raw(']');
+    return w.c_str();
+}
+
+static void buildDupIndex(Group &g); // defined under Duplicate Detection
+
+static void rebuildNameIndex(Group &g) {
+    g.nameIndex = NameIndex();
+    for (uint32_t i = 0; i < g.names.size(); ++i) g.nameIndex.add(g.names, i);
+}
+
+// Exchanges name ids a and b, both at or above rosterSize. Only payers can hold such
+// ids (share rows are roster-only), so expenses, ledger and the payer-keyed indexes
+// are remapped and the share columns are left alone.
+static void swapOutsideNames(Group &g, uint32_t a, uint32_t b) {
+    swap(g.names[a], g.names[b]);
+    swap(g.ledger[a], g.ledger[b]);
+    swap(g.paid[a], g.paid[b]);
+    if (g.byPayer.size() <= max(a, b)) g.byPayer.resize(max(a, b) + 1);
+    swap(g.byPayer[a], g.byPayer[b]);
+    for (auto &e : g.expenses) {
+        if (e.payer == a) e.payer = b;
+        else if (e.payer == b) e.payer = a;
     }
-    ss << "]}";
-    return makeJson(ss.str());
+    vector<pair<pair<string, uint32_t>, MemberSpend>> moved;
+    for (auto it = g.memberByMonth.begin(); it != g.memberByMonth.end();) {
+        uint32_t id = it->first.second;
+        if (id != a && id != b) { ++it; continue; }
+        moved.push_back({{it->first.first, id == a ? b : a}, it->second});
+        it = g.memberByMonth.erase(it);
+    }
+    for (auto &m : moved) g.memberByMonth.emplace(std::move(m.first), m.second);
+    rebuildNameIndex(g);
+    if (g.dupPolicy != DUP_OFF) buildDupIndex(g); // fingerprints hash the payer id
+    LedgerCheckpoints &c = g.checkpoints;
+    if (max(a, b) >= c.width) invalidateCheckpoints(c, "");
+    else for (size_t k = 0; k < c.dates.size(); ++k) swap(c.rows[k * c.width + a], c.rows[k * c.width + b]);
+}
+
+// members may contain empty names, which are skipped.
+static const char* setGroupMembersIn(SsEngine &eng, string_view groupName, string_view members_str) {
+    STAT_SCOPE(setGroupMembers, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    vector<string_view> members;
+    splitPipe(members_str, members);
+
+    uint32_t added = 0;
+    for (auto m : members) {
+        if (m.empty()) continue;
+        uint32_t id = g.nameIndex.find(g.names, m);
+        if (id < g.rosterSize) continue; // also skips repeats within members
+        if (id == NameIndex::npos) id = internName(g, m);
+        // Roster ids come first, so an outside payer joining takes the first outside id.
+        if (id != g.rosterSize) swapOutsideNames(g, id, g.rosterSize);
+        ++g.rosterSize;
+        g.members.emplace_back(m);
+        ++added;
+    }
+    if (added) ++g.version; // name ids may have moved under the cached settlement
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"added\":").uint(added).raw(",\"members\":").uint(g.rosterSize).raw('}');
+    return w.c_str();
+}
+
+static const char* setGroupCurrenciesIn(SsEngine &eng, string_view groupName, string_view base, string_view rates) {
+    STAT_SCOPE(setGroupCurrencies, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    if (base.empty()) return makeJson("{\"error\":\"Base currency empty\"}");
+
+    // Parse everything first so a bad entry changes nothing.
+    vector<string_view> entries;
+    vector<pair<string_view, int64_t>> parsed;
+    splitPipe(rates, entries);
+    for (auto entry : entries) {
+        size_t colon = entry.find(':');
+        string_view code = entry.substr(0, colon);
+        int64_t rate;
+        if (colon == string_view::npos || code.empty() || code == base || !parseRate(entry.substr(colon + 1), rate))
+            return makeJson("{\"error\":\"Invalid rate\"}");
+        parsed.push_back({code, rate});
+    }
+
+    if (g.currencies.empty() || g.currencies[0].code != base) {
+        // Stored amounts are in the old base; there are none to restate only when empty.
+        if (!g.currencies.empty() && g.expenses.size() > g.tombstones)
+            return makeJson("{\"error\":\"Base currency in use\"}");
+        g.currencies.assign(1, Currency{string(base), RATE_SCALE});
+        ++g.version; // balances now read in another unit
+    }
+    for (auto &p : parsed) {
+        size_t c = 1;
+        while (c < g.currencies.size() && g.currencies[c].code != p.first) ++c;
+        if (c == g.currencies.size()) {
+            if (c > UINT16_MAX) return makeJson("{\"error\":\"Too many currencies\"}");
+            g.currencies.push_back({string(p.first), p.second});
+        } else {
+            g.currencies[c].rate = p.second;
+        }
+    }
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"base\":").str(base).raw(",\"currencies\":").uint(g.currencies.size()).raw('}');
+    return w.c_str();
+}
+
+// -------------- Expense Management ----------------
+
+// Fills the fields shared by the text-argument add and edit calls.
+static bool readTextExpense(ExpenseInput &in, string_view name, string_view category, double amount,
+                            string_view payer, string_view members_str, string_view shares_str,
+                            string_view date) {
+    in.name = name;
+    in.category = category;
+    if (!toMoney(amount, in.amount)) in.invalid = "Invalid amount";
+    in.payer = payer;
+    in.date = date;
+    splitPipe(members_str, in.members);
+    return parseShares(shares_str, in.shares);
+}
+
+static const char* addExpenseTo(Group &g, ExpenseInput &in) {
+    Expense e;
+    e.id = g.nextId++;
+    uint32_t dup = 0;
+    const char* err = buildExpense(g, in, e, &dup);
+    if (err && !dup) return errorJson(err);
+    if (err) {
+        JsonWriter w(jsonBuffer);
+        w.raw("{\"error\":").str(err, strlen(err)).raw(",\"duplicateOf\":\"").uint(dup).raw("\"}");
+        return w.c_str();
+    }
+
+    Money total = sharesTotal(g, e), expected = e.amount;
+    trackExpense(g, e, 1);
+    appendExpense(g, std::move(e));
+    if (!dup && approxEqual(total, expected)) return makeJson("{\"ok\":true}");
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true");
+    if (dup) w.raw(",\"duplicateOf\":\"").uint(dup).raw('"');
+    if (!approxEqual(total, expected))
+        w.raw(",\"warning\":\"Shares (").money(total).raw(") != Amount (").money(expected).raw(")\"");
+    w.raw('}');
+    return w.c_str();
+}
+
+static const char* addGroupExpenseIn(SsEngine &eng, string_view groupName, string_view name, string_view category,
+                                     double amount, string_view payer, string_view members_str,
+                                     string_view shares_str, string_view date) {
+    STAT_SCOPE(addGroupExpense, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    ExpenseInput in;
+    if (!readTextExpense(in, name, category, amount, payer, members_str, shares_str, date))
+        return makeJson("{\"error\":\"Invalid share amount\"}");
+    return addExpenseTo(*found, in);
+}
+
+// Packed batch layout (little-endian, no padding):
+//   u32 count, then per expense:
+//   str name, str category, f64 amount, str payer,
+//   u32 memberCount, memberCount x str,
+//   u32 shareCount (0 = equal split), shareCount x f64,
+//   str date, str currency (empty = the group's base; amount and shares are in it)
+// where str is u32 byteLength followed by that many UTF-8 bytes.
+struct BatchReader {
+    const unsigned char* p;
+    const unsigned char* end;
+
+    bool u32(uint32_t &out) {
+        if (end - p < 4) return false;
+        out = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        p += 4;
+        return true;
+    }
+    bool u8(uint8_t &out) {
+        if (end - p < 1) return false;
+        out = *p++;
+        return true;
+    }
+    bool u64(uint64_t &out) {
+        if (end - p < 8) return false;
+        out = 0;
+        for (int i = 7; i >= 0; --i) out = (out << 8) | p[i];
+        p += 8;
+        return true;
+    }
+    bool f64(double &out) {
+        if (end - p < 8) return false;
+        uint64_t bits = 0;
+        for (int i = 7; i >= 0; --i) bits = (bits << 8) | p[i];
+        memcpy(&out, &bits, sizeof out);
+        p += 8;
+        return true;
+    }
+    bool view(string_view &out) {
+        uint32_t n;
+        if (!u32(n) || (uint32_t)(end - p) < n) return false;
+        out = string_view((const char*)p, n);
+        p += n;
+        return true;
+    }
+    bool str(string &out) {
+        string_view v;
+        if (!view(v)) return false;
+        out.assign(v.data(), v.size());
+        return true;
+    }
+};
+
+static bool readBatchExpense(BatchReader &r, ExpenseInput &e) {
+    uint32_t n;
+    double v;
+    if (!r.str(e.name) || !r.str(e.category) || !r.f64(v) || !r.view(e.payer)) return false;
+    if (!toMoney(v, e.amount)) e.invalid = "Invalid amount";
+    if (!r.u32(n) || n > (uint32_t)(r.end - r.p) / 4) return false;
+    e.members.resize(n);
+    for (auto &m : e.members) if (!r.view(m)) return false;
+    if (!r.u32(n) || n > (uint32_t)(r.end - r.p) / 8) return false;
+    e.shares.resize(n);
+    for (auto &s : e.shares) {
+        if (!r.f64(v)) return false;
+        if (!toMoney(v, s) && !e.invalid) e.invalid = "Invalid share amount";
+    }
+    return r.str(e.date) && r.view(e.currency);
+}
+
+static const char* loadGroupExpensesBatchIn(SsEngine &eng, string_view groupName,
+                                           const unsigned char* data, int size) {
+    STAT_SCOPE(loadGroupExpensesBatch, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    if (!data || size < 0) return makeJson("{\"error\":\"Malformed batch\"}");
+
+    BatchReader r{data, data + size};
+    uint32_t count;
+    if (!r.u32(count)) return makeJson("{\"error\":\"Malformed batch\"}");
+
+    const size_t before = g.expenses.size(), rowsBefore = g.shareMember.size(), equalRowsBefore = g.equalMember.size();
+    const size_t deadRowsBefore = g.deadShareRows, namesBefore = g.names.size();
+    const uint32_t nextIdBefore = g.nextId;
+    // A record takes at least 36 bytes (six empty strings, the amount and two counts), so
+    // a false count cannot reserve more than the buffer could hold.
+    g.expenses.reserve(g.expenses.size() + min<size_t>(count, (size_t)size / 36));
+    vector<pair<uint32_t, const char*>> rejected;
+    size_t added = 0, warnings = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        ExpenseInput in;
+        if (!readBatchExpense(r, in)) {
+            // A truncated or corrupt buffer applies nothing, so the caller can simply resend.
+            // The ledger is only settled after the loop, so just the indexes need undoing.
+            for (size_t k = before; k < g.expenses.size(); ++k) {
+                indexExpense(g, g.expenses[k], -1);
+                g.slotById[g.expenses[k].id] = -1;
+            }
+            g.expenses.resize(before);
+            g.shareMember.resize(rowsBefore);
+            g.shareAmount.resize(rowsBefore);
+            g.equalMember.resize(equalRowsBefore);
+            g.deadShareRows = deadRowsBefore;
+            g.nextId = nextIdBefore;
+            // Outside payers first seen in this batch go too, or they would linger as
+            // zero-balance names.
+            if (g.names.size() > namesBefore) {
+                g.names.resize(namesBefore);
+                g.ledger.resize(namesBefore);
+                g.paid.resize(namesBefore);
+                if (g.byPayer.size() > namesBefore) g.byPayer.resize(namesBefore);
+                rebuildNameIndex(g);
+            }
+            JsonWriter w(jsonBuffer);
+            w.raw("{\"error\":\"Malformed batch\",\"index\":").uint(i).raw('}');
+            return w.c_str();
+        }
+        Expense e;
+        uint32_t dup = 0;
+        const char* err = buildExpense(g, in, e, &dup);
+        if (err) {
+            rejected.push_back({i, err});
+            continue;
+        }
+        if (!approxEqual(sharesTotal(g, e), e.amount)) ++warnings;
+        e.id = g.nextId++;
+        indexExpense(g, e, 1);
+        appendExpense(g, std::move(e));
+        ++added;
+    }
+    applyRangeToLedger(g, before, rowsBefore);
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"added\":").uint(added).raw(",\"warnings\":").uint(warnings).raw(",\"rejected\":[");
+    bool first = true;
+    for (auto &r : rejected)
+        w.sep(first).raw("{\"index\":").uint(r.first).raw(",\"error\":").str(r.second, strlen(r.second)).raw('}');
+    w.raw("]}");
+    return w.c_str();
+}
+
+// Op log layout, same conventions as the batch layout above:
+//   u32 count, then per op:
+//   u8 kind (0 added, 1 modified, 2 removed, as in Firestore docChanges), str docId,
+//   and for added/modified one batch expense record.
+// Ops carry no sequence number: Firestore gives a change none that is stable across
+// deliveries. Replays are harmless because every op sets a document's current state.
+enum OpKind : uint8_t { OP_ADDED, OP_MODIFIED, OP_REMOVED };
+
+struct Op {
+    uint8_t kind;
+    string_view docId;
+    ExpenseInput expense;
+};
+
+static bool readOp(BatchReader &r, Op &op) {
+    if (!r.u8(op.kind) || op.kind > OP_REMOVED || !r.view(op.docId)) return false;
+    return op.kind == OP_REMOVED || readBatchExpense(r, op.expense);
+}
+
+static Expense* findExpenseForDoc(Group &g, string_view docId) {
+    auto it = g.idByDoc.find(lookupKey(docId));
+    if (it == g.idByDoc.end() || g.slotById[it->second] < 0) return nullptr;
+    return &g.expenses[g.slotById[it->second]];
+}
+
+// Applies one op; returns an error message or nullptr.
+static const char* applyOp(Group &g, Op &op) {
+    Expense* current = findExpenseForDoc(g, op.docId);
+    if (op.kind == OP_REMOVED) {
+        if (current) removeExpense(g, *current);
+        g.idByDoc.erase(lookupKey(op.docId));
+        return nullptr;
+    }
+
+    // added and modified are both upserts: an "added" for a known document is a
+    // replay, and a "modified" for an unknown one means its add was never seen.
+    Expense e;
+    uint32_t dup = 0;
+    const char* err = buildExpense(g, op.expense, e, current ? nullptr : &dup);
+    if (err) return err;
+    if (current) {
+        replaceExpense(g, *current, std::move(e));
+    } else {
+        e.id = g.nextId++;
+        g.idByDoc[lookupKey(op.docId)] = e.id;
+        trackExpense(g, e, 1);
+        appendExpense(g, std::move(e));
+    }
+    return nullptr;
+}
+
+static const char* applyGroupOpsIn(SsEngine &eng, string_view groupName,
+                                   const unsigned char* data, int size) {
+    STAT_SCOPE(applyGroupOps, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    if (!data || size < 0) return makeJson("{\"error\":\"Malformed op log\"}");
+
+    // Decode the whole log first; a corrupt buffer applies nothing.
+    BatchReader r{data, data + size};
+    uint32_t count;
+    // The smallest op, a removal with an empty docId, takes 5 bytes. Each decoded Op
+    // takes far more, so ops are appended as they decode instead of sized from count.
+    if (!r.u32(count) || count > (uint32_t)size / 5) return makeJson("{\"error\":\"Malformed op log\"}");
+    vector<Op> ops;
+    for (uint32_t i = 0; i < count; ++i) {
+        ops.emplace_back();
+        if (!readOp(r, ops.back())) {
+            JsonWriter w(jsonBuffer);
+            w.raw("{\"error\":\"Malformed op log\",\"index\":").uint(i).raw('}');
+            return w.c_str();
+        }
+    }
+
+    vector<pair<uint32_t, const char*>> rejected;
+    size_t applied = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char* err = applyOp(g, ops[i]);
+        if (err) rejected.push_back({i, err});
+        else ++applied;
+    }
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"applied\":").uint(applied).raw(",\"rejected\":[");
+    bool first = true;
+    for (auto &x : rejected)
+        w.sep(first).raw("{\"index\":").uint(x.first).raw(",\"error\":").str(x.second, strlen(x.second)).raw('}');
+    w.raw("]}");
+    return w.c_str();
+}
+
+static const char* getGroupSyncStateIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(getGroupSyncState, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"docs\":").uint(found->idByDoc.size()).raw('}');
+    return w.c_str();
+}
+
+static const char* editExpenseTo(Group &g, string_view expenseId, ExpenseInput &in) {
+    Expense* target = findExpense(g, expenseId);
+    if (!target) return makeJson("{\"error\":\"Expense not found\"}");
+
+    // Build and validate the replacement first so a rejected edit leaves
+    // both the expense and the ledger untouched.
+    Expense updated;
+    const char* err = buildExpense(g, in, updated);
+    if (err) return errorJson(err);
+
+    replaceExpense(g, *target, std::move(updated));
+    return makeJson("{\"ok\":true}");
+}
+
+static const char* editExpenseIn(SsEngine &eng, string_view groupName, string_view expenseId,
+                                 string_view name, string_view category, double amount,
+                                 string_view payer, string_view members_str,
+                                 string_view shares_str, string_view date) {
+    STAT_SCOPE(editExpense, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    if (!findExpense(*found, expenseId)) return makeJson("{\"error\":\"Expense not found\"}");
+    ExpenseInput in;
+    if (!readTextExpense(in, name, category, amount, payer, members_str, shares_str, date))
+        return makeJson("{\"error\":\"Invalid share amount\"}");
+    return editExpenseTo(*found, expenseId, in);
+}
+
+static const char* deleteExpenseIn(SsEngine &eng, string_view groupName, string_view expenseId) {
+    STAT_SCOPE(deleteExpense, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+
+    Expense* e = findExpense(g, expenseId);
+    if (!e) return makeJson("{\"error\":\"Expense not found\"}");
+
+    removeExpense(g, *e);
+    return makeJson("{\"ok\":true}");
+}
+
+// -------------- Duplicate Detection ----------------
+
+static const char* const DUP_POLICY_NAMES[] = {"off", "flag", "reject"};
+
+// Indexes every live expense; the policy must already be on.
+static void buildDupIndex(Group &g) {
+    g.dupIndex.clear();
+    g.dupIndex.reserve(g.expenses.size() - g.tombstones);
+    for (auto &e : g.expenses)
+        if (e.live) indexFingerprint(g, e, 1);
+}
+
+static const char* setDuplicatePolicyIn(SsEngine &eng, string_view groupName, string_view policy) {
+    STAT_SCOPE(setDuplicatePolicy, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    int p = 0;
+    while (p <= DUP_REJECT && policy != DUP_POLICY_NAMES[p]) ++p;
+    if (p > DUP_REJECT) return makeJson("{\"error\":\"Unknown policy\"}");
+
+    bool wasOn = g.dupPolicy != DUP_OFF;
+    g.dupPolicy = (DupPolicy)p;
+    if (g.dupPolicy == DUP_OFF) unordered_multimap<uint64_t, uint32_t>().swap(g.dupIndex);
+    else if (!wasOn) buildDupIndex(g);
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"policy\":").str(policy).raw('}');
+    return w.c_str();
+}
+
+static const char* findDuplicatesIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(findDuplicates, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    const Group &g = *found;
+
+    // (fingerprint, id) for every live expense, sorted so only equal fingerprints,
+    // almost always true duplicates, are ever compared.
+    vector<pair<uint64_t, uint32_t>> prints;
+    prints.reserve(g.expenses.size() - g.tombstones);
+    if (g.dupPolicy != DUP_OFF) prints.assign(g.dupIndex.begin(), g.dupIndex.end());
+    else for (auto &e : g.expenses) if (e.live) prints.push_back({expenseFingerprint(g, e), e.id});
+    sort(prints.begin(), prints.end());
+
+    vector<vector<uint32_t>> sets;
+    vector<bool> placed;
+    vector<uint32_t> members;
+    for (size_t i = 0, j; i < prints.size(); i = j) {
+        for (j = i + 1; j < prints.size() && prints[j].first == prints[i].first; ++j) {}
+        if (j - i < 2) continue;
+        placed.assign(j - i, false);
+        for (size_t a = i; a < j; ++a) {
+            if (placed[a - i]) continue;
+            const Expense &first = g.expenses[g.slotById[prints[a].second]];
+            vector<uint32_t> set{first.id};
+            sortedMembers(g, first, members);
+            for (size_t b = a + 1; b < j; ++b) {
+                if (placed[b - i] || !sameSpend(g, first, members, g.expenses[g.slotById[prints[b].second]])) continue;
+                placed[b - i] = true;
+                set.push_back(prints[b].second);
+            }
+            if (set.size() > 1) sets.push_back(std::move(set));
+        }
+    }
+    sort(sets.begin(), sets.end());
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"group\":").str(g.name).raw(",\"duplicates\":[");
+    bool first = true;
+    for (auto &set : sets) {
+        w.sep(first).raw('[');
+        bool firstId = true;
+        for (uint32_t id : set) w.sep(firstId).raw('"').uint(id).raw('"');
+        w.raw(']');
+    }
+    w.raw("]}");
+    return w.c_str();
+}
+
+// -------------- Packed Arguments ----------------
+
+// Length-prefixed variants of the calls that carry user text, for callers holding
+// UTF-8 buffers (no NUL scan, no embedded-NUL truncation). Each takes one buffer in
+// the batch conventions (str = u32 byteLength + bytes, see BatchReader):
+//   createGroup:     str groupName, u32 memberCount, memberCount x str
+//   addGroupExpense: str groupName, one batch expense record
+//   editExpense:     str groupName, str expenseId, one batch expense record
+//   deleteExpense:   str groupName, str expenseId
+// Strings are read in place; only the fields an expense stores are copied.
+
+static const char* malformedArgs() {
+    return makeJson("{\"error\":\"Malformed arguments\"}");
+}
+
+static const char* createGroupPackedIn(SsEngine &eng, const unsigned char* data, int size) {
+    STAT_SCOPE(createGroupPacked, STAT_JSON);
+    if (!data || size < 0) return malformedArgs();
+    BatchReader r{data, data + size};
+    string_view groupName;
+    uint32_t n;
+    if (!r.view(groupName) || !r.u32(n) || n > (uint32_t)(r.end - r.p) / 4) return malformedArgs();
+    vector<string_view> members(n);
+    for (auto &m : members) if (!r.view(m)) return malformedArgs();
+    if (r.p != r.end) return malformedArgs();
+    return createGroupWith(eng, groupName, members);
+}
+
+static const char* addGroupExpensePackedIn(SsEngine &eng, const unsigned char* data, int size) {
+    STAT_SCOPE(addGroupExpensePacked, STAT_JSON);
+    if (!data || size < 0) return malformedArgs();
+    BatchReader r{data, data + size};
+    string_view groupName;
+    ExpenseInput in;
+    if (!r.view(groupName) || !readBatchExpense(r, in) || r.p != r.end) return malformedArgs();
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    return addExpenseTo(*found, in);
+}
+
+static const char* editExpensePackedIn(SsEngine &eng, const unsigned char* data, int size) {
+    STAT_SCOPE(editExpensePacked, STAT_JSON);
+    if (!data || size < 0) return malformedArgs();
+    BatchReader r{data, data + size};
+    string_view groupName, expenseId;
+    ExpenseInput in;
+    if (!r.view(groupName) || !r.view(expenseId) || !readBatchExpense(r, in) || r.p != r.end)
+        return malformedArgs();
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    return editExpenseTo(*found, expenseId, in);
+}
+
+static const char* deleteExpensePackedIn(SsEngine &eng, const unsigned char* data, int size) {
+    STAT_SCOPE(deleteExpensePacked, STAT_JSON);
+    if (!data || size < 0) return malformedArgs();
+    BatchReader r{data, data + size};
+    string_view groupName, expenseId;
+    if (!r.view(groupName) || !r.view(expenseId) || r.p != r.end) return malformedArgs();
+    return deleteExpenseIn(eng, groupName, expenseId);
+}
+
+static void writeExpense(JsonWriter &w, const Group &g, const Expense &e) {
+    w.raw("{\"id\":\"").uint(e.id).raw("\",\"name\":").str(e.name)
+     .raw(",\"category\":").str(e.category)
+     .raw(",\"amount\":").money(e.amount);
+    if (e.currency)
+        w.raw(",\"originalAmount\":").money(e.original).raw(",\"originalCurrency\":").str(g.currencies[e.currency].code);
+    w.raw(",\"payer\":").str(g.names[e.payer])
+     .raw(",\"members\":[");
+    bool first = true;
+    forEachShare(g, e, [&](uint32_t id, Money) { w.sep(first).str(g.names[id]); });
+    w.raw("],\"shares\":[");
+    first = true;
+    forEachShare(g, e, [&](uint32_t, Money share) { w.sep(first).money(share); });
+    w.raw("],\"date\":").str(e.date).raw('}');
+}
+
+static const char* showGroupExpensesIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(showGroupExpenses, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+
+    size_t live = g.expenses.size() - g.tombstones;
+    JsonWriter w(jsonBuffer);
+    w.reserve(64 + live * 160);
+    w.raw("{\"group\":").str(groupName).raw(",\"expenses\":[");
+    bool first = true;
+    for (auto &e : g.expenses) {
+        if (!e.live) continue;
+        writeExpense(w.sep(first), g, e);
+    }
+    w.raw("]}");
+    return w.c_str();
+}
+
+static const char* queryGroupExpensesIn(SsEngine &eng, string_view groupName, int offset, int limit,
+                                        string_view dateFrom, string_view dateTo,
+                                        string_view category, string_view payer) {
+    STAT_SCOPE(queryGroupExpenses, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+
+    string_view from = dateFrom, to = dateTo, cat = category, who = payer;
+    size_t skip = offset > 0 ? (size_t)offset : 0;
+    size_t take = limit >= 0 ? (size_t)limit : SIZE_MAX;
+    static const vector<uint32_t> none;
+
+    // With a category or payer filter, start from the shorter posting list and check
+    // the remaining filters per row. Otherwise the date index already yields rows in
+    // output order, so whole buckets can be skipped without touching their expenses.
+    const vector<uint32_t>* postings = nullptr;
+    uint32_t payerId = UINT32_MAX;
+    if (!who.empty()) {
+        payerId = g.nameIndex.find(g.names, who);
+        postings = payerId < g.byPayer.size() ? &g.byPayer[payerId] : &none;
+    }
+    if (!cat.empty()) {
+        auto it = g.byCategory.find(lookupKey(cat));
+        const vector<uint32_t>* list = it != g.byCategory.end() ? &it->second : &none;
+        if (!postings || list->size() < postings->size()) postings = list;
+    }
+
+    vector<const Expense*> page;
+    size_t total = 0;
+    if (postings) {
+        vector<const Expense*> matches;
+        for (uint32_t id : *postings) {
+            const Expense &e = g.expenses[g.slotById[id]];
+            if (!cat.empty() && e.category != cat) continue;
+            if (!who.empty() && e.payer != payerId) continue;
+            if (!from.empty() && e.date < from) continue;
+            if (!to.empty() && e.date > to) continue;
+            matches.push_back(&e);
+        }
+        total = matches.size();
+        sort(matches.begin(), matches.end(), [](const Expense* a, const Expense* b) {
+            return a->date != b->date ? a->date < b->date : a->id < b->id;
+        });
+        for (size_t i = skip; i < matches.size() && page.size() < take; ++i) page.push_back(matches[i]);
+    } else {
+        auto it = from.empty() ? g.byDate.begin() : g.byDate.lower_bound(from);
+        auto end = to.empty() ? g.byDate.end() : g.byDate.upper_bound(to);
+        if (!from.empty() && !to.empty() && from > to) it = end;
+        size_t seen = 0;
+        for (; it != end; ++it) {
+            const vector<uint32_t> &ids = it->second;
+            total += ids.size();
+            if (page.size() >= take || seen + ids.size() <= skip) {
+                seen += ids.size();
+                continue;
+            }
+            for (size_t i = skip > seen ? skip - seen : 0; i < ids.size() && page.size() < take; ++i)
+                page.push_back(&g.expenses[g.slotById[ids[i]]]);
+            seen += ids.size();
+        }
+    }
+
+    JsonWriter w(jsonBuffer);
+    w.reserve(96 + page.size() * 160);
+    w.raw("{\"group\":").str(groupName).raw(",\"total\":").uint(total)
+     .raw(",\"offset\":").uint(skip).raw(",\"expenses\":[");
+    bool first = true;
+    for (const Expense* e : page) writeExpense(w.sep(first), g, *e);
+    w.raw("]}");
+    return w.c_str();
+}
+
+static const char* getSpendingSummaryIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(getSpendingSummary, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+
+    JsonWriter w(jsonBuffer);
+    w.reserve(64 + (g.categoryByMonth.size() + g.memberByMonth.size()) * 72);
+    w.raw("{\"group\":").str(groupName).raw(",\"byCategory\":[");
+    bool first = true;
+    for (auto &c : g.categoryByMonth) {
+        w.sep(first).raw("{\"month\":").str(c.first.first).raw(",\"category\":").str(c.first.second)
+         .raw(",\"total\":").money(c.second.total).raw(",\"count\":").uint(c.second.count).raw('}');
+    }
+    w.raw("],\"byMember\":[");
+    first = true;
+    for (auto &m : g.memberByMonth) {
+        w.sep(first).raw("{\"month\":").str(m.first.first).raw(",\"member\":").str(g.names[m.first.second])
+         .raw(",\"paid\":").money(m.second.paid).raw(",\"share\":").money(m.second.share).raw('}');
+    }
+    w.raw("]}");
+    return w.c_str();
+}
+
+// -------------- Streaming Import / Export ----------------
+
+// Columns of the CSV/NDJSON interchange format: CSV header names and NDJSON keys.
+enum ImportColumn { IMP_ID, IMP_NAME, IMP_CATEGORY, IMP_AMOUNT, IMP_PAYER, IMP_MEMBERS, IMP_SHARES, IMP_DATE,
+                    IMP_CURRENCY, IMP_COLUMN_COUNT };
+static const char* const IMPORT_COLUMNS[IMP_COLUMN_COUNT] = {
+    "id", "name", "category", "amount", "payer", "members", "shares", "date", "currency"
+};
+
+static const size_t IMPORT_MAX_RECORD = 1 << 20;  // longer records are rejected and skipped
+static const size_t IMPORT_MAX_REPORTED = 100;    // rejected rows listed per call; the rest are counted
+
+static bool importFormat(string_view format, bool &csv) {
+    csv = format == "csv";
+    return csv || format == "ndjson";
+}
+
+static int importColumn(string_view key) {
+    while (!key.empty() && key.front() == ' ') key.remove_prefix(1);
+    while (!key.empty() && key.back() == ' ') key.remove_suffix(1);
+    for (int c = 0; c < IMP_COLUMN_COUNT; ++c) {
+        string_view name = IMPORT_COLUMNS[c];
+        if (key.size() != name.size()) continue;
+        size_t i = 0;
+        while (i < key.size() && (key[i] >= 'A' && key[i] <= 'Z' ? key[i] + 32 : key[i]) == name[i]) ++i;
+        if (i == key.size()) return c;
+    }
+    return -1;
+}
+
+// Splits one CSV record into fields (RFC 4180: a quoted field may hold commas, newlines
+// and "" for a quote). Returns false on text after a closing quote or a missing one.
+static bool splitCsvRecord(string_view rec, vector<string> &fields, size_t &count) {
+    count = 0;
+    size_t i = 0, n = rec.size();
+    for (;;) {
+        if (count == fields.size()) fields.emplace_back();
+        string &f = fields[count++];
+        f.clear();
+        if (i < n && rec[i] == '"') {
+            for (++i;;) {
+                size_t q = rec.find('"', i);
+                if (q == string_view::npos) return false;
+                f.append(rec.data() + i, q - i);
+                i = q + 1;
+                if (i < n && rec[i] == '"') {
+                    f.push_back('"');
+                    ++i;
+                } else {
+                    break;
+                }
+            }
+            if (i < n && rec[i] != ',') return false;
+        } else {
+            size_t comma = rec.find(',', i);
+            if (comma == string_view::npos) comma = n;
+            f.append(rec.data() + i, comma - i);
+            i = comma;
+        }
+        if (i >= n) return true;
+        ++i;
+    }
+}
+
+// Reads the flat objects of an NDJSON import: string, number and null values, arrays
+// of those (joined with '|' like the text API's lists), and any other value skipped.
+struct JsonLineReader {
+    const char* p;
+    const char* end;
+
+    void ws() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    }
+    bool lit(char c) {
+        ws();
+        if (p == end || *p != c) return false;
+        ++p;
+        return true;
+    }
+    bool word(const char* w) {
+        size_t n = strlen(w);
+        if ((size_t)(end - p) < n || memcmp(p, w, n)) return false;
+        p += n;
+        return true;
+    }
+    static int hex(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        c = (char)(c | 0x20);
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    }
+    bool hex4(uint32_t &out) {
+        if (end - p < 4) return false;
+        out = 0;
+        for (int i = 0; i < 4; ++i) {
+            int d = hex(p[i]);
+            if (d < 0) return false;
+            out = out << 4 | (uint32_t)d;
+        }
+        p += 4;
+        return true;
+    }
+    static void utf8(string &out, uint32_t c) {
+        if (c < 0x80) {
+            out.push_back((char)c);
+        } else if (c < 0x800) {
+            out.push_back((char)(0xC0 | c >> 6));
+            out.push_back((char)(0x80 | (c & 0x3F)));
+        } else if (c < 0x10000) {
+            out.push_back((char)(0xE0 | c >> 12));
+            out.push_back((char)(0x80 | (c >> 6 & 0x3F)));
+            out.push_back((char)(0x80 | (c & 0x3F)));
+        } else {
+            out.push_back((char)(0xF0 | c >> 18));
+            out.push_back((char)(0x80 | (c >> 12 & 0x3F)));
+            out.push_back((char)(0x80 | (c >> 6 & 0x3F)));
+            out.push_back((char)(0x80 | (c & 0x3F)));
+        }
+    }
+
+    // Appends the unescaped string; unpaired surrogates become U+FFFD.
+    bool str(string &out) {
+        if (!lit('"')) return false;
+        for (;;) {
+            const char* run = p;
+            while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) ++p;
+            out.append(run, p - run);
+            if (p == end || (unsigned char)*p < 0x20) return false;
+            if (*p++ == '"') return true;
+            if (p == end) return false;
+            char c = *p++;
+            switch (c) {
+                case '"': case '\\': case '/': out.push_back(c); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u': {
+                    uint32_t u, lo;
+                    if (!hex4(u)) return false;
+                    if (u >= 0xD800 && u < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        const char* back = p;
+                        p += 2;
+                        if (hex4(lo) && lo >= 0xDC00 && lo < 0xE000) u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+                        else p = back;
+                    }
+                    utf8(out, u >= 0xD800 && u < 0xE000 ? 0xFFFD : u);
+                    break;
+                }
+                default: return false;
+            }
+        }
+    }
+
+    // A string, or a number kept as its text for parseMoney; null leaves out unchanged.
+    bool scalar(string &out) {
+        ws();
+        if (p == end) return false;
+        if (*p == '"') return str(out);
+        if (word("null")) return true;
+        const char* start = p;
+        while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) ++p;
+        out.append(start, p - start);
+        return p != start;
+    }
+
+    bool value(string &out) {
+        if (!lit('[')) return scalar(out);
+        if (lit(']')) return true;
+        bool first = true;
+        do {
+            if (!first) out.push_back('|');
+            first = false;
+            if (!scalar(out)) return false;
+        } while (lit(','));
+        return lit(']');
+    }
+
+    bool skip(int depth = 0) {
+        static thread_local string scratch;
+        ws();
+        if (p == end || depth > 32) return false;
+        if (*p == '{' || *p == '[') {
+            char close = *p == '{' ? '}' : ']';
+            bool object = *p++ == '{';
+            if (lit(close)) return true;
+            do {
+                scratch.clear();
+                if (object && (!str(scratch) || !lit(':'))) return false;
+                if (!skip(depth + 1)) return false;
+            } while (lit(','));
+            return lit(close);
+        }
+        if (word("true") || word("false")) return true;
+        scratch.clear();
+        return scalar(scratch);
+    }
+};
+
+static bool readJsonRow(string_view line, vector<string> &values) {
+    static thread_local string key;
+    for (auto &v : values) v.clear();
+    JsonLineReader r{line.data(), line.data() + line.size()};
+    if (!r.lit('{')) return false;
+    if (!r.lit('}')) {
+        do {
+            key.clear();
+            if (!r.str(key) || !r.lit(':')) return false;
+            int col = importColumn(key);
+            if (col < 0 ? !r.skip() : (values[col].clear(), !r.value(values[col]))) return false;
+        } while (r.lit(','));
+        if (!r.lit('}')) return false;
+    }
+    r.ws();
+    return r.p == r.end;
+}
+
+// Fills in from one row's text fields, as readTextExpense does for the C API strings.
+static const char* readImportRow(const string_view* field, ExpenseInput &in) {
+    if (!parseMoney(field[IMP_AMOUNT], in.amount)) return "Invalid amount";
+    if (field[IMP_PAYER].empty()) return "Missing payer";
+    in.name.assign(field[IMP_NAME].data(), field[IMP_NAME].size());
+    in.category.assign(field[IMP_CATEGORY].data(), field[IMP_CATEGORY].size());
+    in.date.assign(field[IMP_DATE].data(), field[IMP_DATE].size());
+    in.payer = field[IMP_PAYER];
+    in.currency = field[IMP_CURRENCY];
+    splitPipe(field[IMP_MEMBERS], in.members);
+    in.shares.clear();
+    if (!parseShares(field[IMP_SHARES], in.shares)) return "Invalid share amount";
+    return nullptr;
+}
+
+// One feed or finish call. Rows are indexed as they arrive and settled into the ledger
+// together when the call ends, the way loadGroupExpensesBatch does.
+struct ImportRun {
+    Group &g;
+    size_t before, rowsBefore, equalRowsBefore;
+    uint64_t added = 0, warnings = 0, rejected = 0;
+    vector<pair<uint64_t, const char*>> errors; // (line, message)
+
+    explicit ImportRun(Group &g)
+        : g(g), before(g.expenses.size()), rowsBefore(g.shareMember.size()), equalRowsBefore(g.equalMember.size()) {}
+
+    void reject(uint64_t line, const char* err) {
+        ++rejected;
+        if (errors.size() < IMPORT_MAX_REPORTED) errors.push_back({line, err});
+    }
+
+    void finish() {
+        // A chunk that added nothing leaves the version, and so the caches, alone.
+        bool grew = g.expenses.size() != before || g.shareMember.size() != rowsBefore ||
+                    g.equalMember.size() != equalRowsBefore;
+        if (grew) applyRangeToLedger(g, before, rowsBefore);
+        g.import.added += added;
+        g.import.warnings += warnings;
+        g.import.rejected += rejected;
+    }
+};
+
+// Consumes one record without its newline. Returns an error that ends the import
+// (an unusable CSV header), or nullptr.
+static const char* importRecord(ImportRun &run, string_view rec) {
+    static thread_local vector<string> fields;
+    GroupImport &imp = run.g.import;
+    const uint64_t line = imp.line + 1;
+    imp.line += 1 + (imp.csv ? (uint64_t)count(rec.begin(), rec.end(), '\n') : 0);
+
+    if (line == 1 && rec.substr(0, 3) == "\xEF\xBB\xBF") rec.remove_prefix(3);
+    if (!rec.empty() && rec.back() == '\r') rec.remove_suffix(1);
+    if (rec.find_first_not_of(" \t") == string_view::npos) return nullptr;
+
+    string_view field[IMP_COLUMN_COUNT];
+    size_t n;
+    if (!imp.csv) {
+        fields.resize(IMP_COLUMN_COUNT);
+        if (!readJsonRow(rec, fields)) {
+            run.reject(line, "Malformed JSON");
+            return nullptr;
+        }
+        for (int c = 0; c < IMP_COLUMN_COUNT; ++c) field[c] = fields[c];
+    } else if (!splitCsvRecord(rec, fields, n)) {
+        run.reject(line, "Malformed CSV field");
+        return nullptr;
+    } else if (imp.columns.empty()) {
+        imp.columns.assign(IMP_COLUMN_COUNT, -1);
+        for (size_t i = n; i-- > 0;) {
+            int c = importColumn(fields[i]);
+            if (c >= 0) imp.columns[c] = (int)i;
+        }
+        if (imp.columns[IMP_AMOUNT] < 0 || imp.columns[IMP_PAYER] < 0 || imp.columns[IMP_MEMBERS] < 0)
+            return "CSV header needs amount, payer and members columns";
+        return nullptr;
+    } else {
+        for (int c = 0; c < IMP_COLUMN_COUNT; ++c)
+            if (imp.columns[c] >= 0 && (size_t)imp.columns[c] < n) field[c] = fields[imp.columns[c]];
+    }
+
+    ExpenseInput in;
+    Expense e;
+    const char* err = readImportRow(field, in);
+    uint32_t dup = 0;
+    if (!err) err = buildExpense(run.g, in, e, &dup);
+    if (err) {
+        run.reject(line, err);
+        return nullptr;
+    }
+    if (!approxEqual(sharesTotal(run.g, e), e.amount)) ++run.warnings;
+    e.id = run.g.nextId++;
+    indexExpense(run.g, e, 1);
+    appendExpense(run.g, std::move(e));
+    ++run.added;
+    return nullptr;
+}
+
+// Offset of the newline ending the record that s continues (for CSV, one outside
+// quotes, carrying the quote state across chunks), or npos.
+static size_t findRecordEnd(GroupImport &imp, string_view s) {
+    if (!imp.csv) return s.find('\n');
+    for (size_t i = 0;; ++i) {
+        i = s.find_first_of(imp.quoted ? "\"" : "\"\n", i);
+        if (i == string_view::npos || s[i] == '\n') return i;
+        imp.quoted = !imp.quoted;
+    }
+}
+
+static const char* feedImport(ImportRun &run, string_view chunk) {
+    GroupImport &imp = run.g.import;
+    while (!chunk.empty()) {
+        if (imp.skipping) {
+            size_t nl = chunk.find('\n');
+            if (nl == string_view::npos) return nullptr;
+            chunk.remove_prefix(nl + 1);
+            ++imp.line;
+            imp.skipping = false;
+            continue;
+        }
+        size_t end = findRecordEnd(imp, chunk);
+        if (end == string_view::npos) {
+            if (imp.pending.size() + chunk.size() > IMPORT_MAX_RECORD) {
+                run.reject(imp.line + 1, "Record too long");
+                imp.line += count(imp.pending.begin(), imp.pending.end(), '\n') + count(chunk.begin(), chunk.end(), '\n');
+                imp.pending.clear();
+                imp.skipping = true;
+                imp.quoted = false;
+                return nullptr;
+            }
+            imp.pending.append(chunk.data(), chunk.size());
+            return nullptr;
+        }
+        const char* err;
+        if (imp.pending.empty()) {
+            err = importRecord(run, chunk.substr(0, end));
+        } else {
+            imp.pending.append(chunk.data(), end);
+            err = importRecord(run, imp.pending);
+            imp.pending.clear();
+        }
+        chunk.remove_prefix(end + 1);
+        if (err) return err;
+    }
+    return nullptr;
+}
+
+static const char* importResult(const ImportRun &run, uint64_t added, uint64_t warnings, uint64_t rejected) {
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"added\":").uint(added).raw(",\"warnings\":").uint(warnings)
+     .raw(",\"rejectedCount\":").uint(rejected).raw(",\"lines\":").uint(run.g.import.line).raw(",\"rejected\":[");
+    bool first = true;
+    for (auto &x : run.errors)
+        w.sep(first).raw("{\"line\":").uint(x.first).raw(",\"error\":").str(x.second, strlen(x.second)).raw('}');
+    w.raw("]}");
+    return w.c_str();
+}
+
+static const char* abortImport(Group &g, const char* err) {
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"error\":").str(err, strlen(err)).raw(",\"line\":").uint(g.import.line).raw('}');
+    g.import = GroupImport();
+    return w.c_str();
+}
+
+static const char* beginGroupImportIn(SsEngine &eng, string_view groupName, string_view format) {
+    STAT_SCOPE(beginGroupImport, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    bool csv;
+    if (!importFormat(format, csv)) return makeJson("{\"error\":\"Unknown format\"}");
+    found->import = GroupImport();
+    found->import.active = true;
+    found->import.csv = csv;
+    return makeJson("{\"ok\":true}");
+}
+
+static const char* feedGroupImportIn(SsEngine &eng, string_view groupName, const unsigned char* data, int size) {
+    STAT_SCOPE(feedGroupImport, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    if (!g.import.active) return makeJson("{\"error\":\"No import in progress\"}");
+    if ((!data && size) || size < 0) return makeJson("{\"error\":\"Malformed chunk\"}");
+
+    ImportRun run(g);
+    const char* err = feedImport(run, string_view((const char*)data, (size_t)size));
+    run.finish();
+    if (err) return abortImport(g, err);
+    return importResult(run, run.added, run.warnings, run.rejected);
+}
+
+static const char* finishGroupImportIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(finishGroupImport, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    GroupImport &imp = g.import;
+    if (!imp.active) return makeJson("{\"error\":\"No import in progress\"}");
+
+    ImportRun run(g);
+    const char* err = nullptr;
+    if (imp.quoted) run.reject(imp.line + 1, "Unterminated quoted field");
+    else if (!imp.skipping && !imp.pending.empty()) err = importRecord(run, imp.pending);
+    run.finish();
+    if (err) return abortImport(g, err);
+    const char* result = importResult(run, imp.added, imp.warnings, imp.rejected);
+    imp = GroupImport(); // also releases pending
+    return result;
+}
+
+// Quotes a CSV field only when it needs it.
+static void appendCsvField(string &out, string_view s) {
+    if (s.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(s.data(), s.size());
+        return;
+    }
+    out.push_back('"');
+    for (char c : s) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+// One CSV row in IMPORT_COLUMNS order. An even split leaves shares empty, which the
+// importer reads back as an even split. Amounts are in the base currency, so the
+// currency column stays empty.
+static void writeCsvExpense(string &out, const Group &g, const Expense &e) {
+    static thread_local string list;
+    char buf[32];
+    char* end = buf + sizeof buf;
+    out.clear();
+    out.append(buf, to_chars(buf, end, e.id).ptr);
+    out.push_back(',');
+    appendCsvField(out, e.name);
+    out.push_back(',');
+    appendCsvField(out, e.category);
+    out.push_back(',');
+    char* p = formatMoney(e.amount, end);
+    out.append(p, end - p);
+    out.push_back(',');
+    appendCsvField(out, g.names[e.payer]);
+    out.push_back(',');
+    list.clear();
+    forEachShare(g, e, [&](uint32_t id, Money) {
+        if (!list.empty()) list.push_back('|');
+        list += g.names[id];
+    });
+    appendCsvField(out, list);
+    out.push_back(',');
+    if (!e.equalSplit) {
+        bool first = true;
+        forEachShare(g, e, [&](uint32_t, Money share) {
+            if (!first) out.push_back('|');
+            first = false;
+            char* s = formatMoney(share, end);
+            out.append(s, end - s);
+        });
+    }
+    out.push_back(',');
+    appendCsvField(out, e.date);
+    out.append(",\n");
+}
+
+static const char* exportGroupExpensesChunkIn(SsEngine &eng, string_view groupName, string_view format,
+                                              int cursor, unsigned char* out, int capacity) {
+    STAT_SCOPE(exportGroupExpensesChunk, STAT_JSON);
+    static thread_local string row;
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    const Group &g = *found;
+    bool csv;
+    if (!importFormat(format, csv)) return makeJson("{\"error\":\"Unknown format\"}");
+    if (!out || capacity < 0 || cursor < 0) return makeJson("{\"error\":\"Invalid buffer\"}");
+
+    size_t written = 0;
+    uint32_t next = (uint32_t)cursor;
+    auto put = [&]() {
+        if (row.size() > (size_t)capacity - written) return false;
+        memcpy(out + written, row.data(), row.size());
+        written += row.size();
+        return true;
+    };
+    auto tooSmall = [&]() {
+        JsonWriter w(jsonBuffer);
+        w.raw("{\"error\":\"Buffer too small\",\"needed\":").uint(row.size()).raw('}');
+        return w.c_str();
+    };
+
+    if (next == 0) {
+        next = 1;
+        if (csv) {
+            row.clear();
+            for (int c = 0; c < IMP_COLUMN_COUNT; ++c) {
+                row += IMPORT_COLUMNS[c];
+                row.push_back(c + 1 < IMP_COLUMN_COUNT ? ',' : '\n');
+            }
+            if (!put()) return tooSmall();
+        }
+    }
+
+    // The cursor is an id; start from the first live expense at or after it.
+    size_t slot = g.expenses.size();
+    for (uint32_t id = next; id < g.slotById.size(); ++id) {
+        if (g.slotById[id] >= 0) {
+            slot = (size_t)g.slotById[id];
+            break;
+        }
+    }
+    for (; slot < g.expenses.size(); ++slot) {
+        const Expense &e = g.expenses[slot];
+        if (!e.live) continue;
+        if (csv) {
+            writeCsvExpense(row, g, e);
+        } else {
+            JsonWriter w(row);
+            writeExpense(w, g, e);
+            w.raw('\n');
+        }
+        if (!put()) {
+            if (!written) return tooSmall();
+            break;
+        }
+        next = e.id + 1;
+    }
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"written\":").uint(written).raw(",\"cursor\":").uint(next);
+    if (slot == g.expenses.size()) w.raw(",\"done\":true}");
+    else w.raw(",\"done\":false}");
+    return w.c_str();
+}
+
+// Columnar expense export. The buffer starts with a header of ColHeader u32 fields;
+// every *Off field is a byte offset from the buffer start, aligned to 8 so JS can
+// lay BigInt64Array/Uint32Array views straight over HEAPU8.buffer. Amount and
+// share columns are int64 minor units (Money). String columns
+// hold (offset, length) u32 pairs into the deduplicated UTF-8 string table, and
+// shareStart[i]..shareStart[i+1] is the range of share rows owned by expense i.
+enum ColHeader : uint32_t {
+    COL_MAGIC, COL_VERSION, COL_EXPENSE_COUNT, COL_SHARE_COUNT,
+    COL_AMOUNT_OFF, COL_SHARE_AMOUNT_OFF, COL_ID_OFF, COL_NAME_OFF,
+    COL_CATEGORY_OFF, COL_PAYER_OFF, COL_DATE_OFF, COL_SHARE_START_OFF,
+    COL_SHARE_MEMBER_OFF, COL_STRINGS_OFF, COL_STRINGS_SIZE, COL_TOTAL_SIZE,
+    COL_HEADER_FIELDS
+};
+static const uint32_t COL_MAGIC_VALUE = 0x31435353; // "SSC1"
+
+struct StringTable {
+    string bytes;
+    unordered_map<string, uint32_t> offsets;
+
+    // Appends (offset, length) for s, storing each distinct string once.
+    void ref(const string &s, vector<uint32_t> &out) {
+        auto it = offsets.find(s);
+        uint32_t off;
+        if (it != offsets.end()) off = it->second;
+        else {
+            off = (uint32_t)bytes.size();
+            bytes += s;
+            offsets.emplace(s, off);
+        }
+        out.push_back(off);
+        out.push_back((uint32_t)s.size());
+    }
+};
+
+template <typename T>
+static uint32_t appendColumn(vector<unsigned char> &buf, const T *data, size_t count) {
+    size_t off = (buf.size() + 7) & ~(size_t)7;
+    buf.resize(off + count * sizeof(T));
+    if (count) memcpy(buf.data() + off, data, count * sizeof(T));
+    return (uint32_t)off;
+}
+
+static const unsigned char* exportGroupExpensesColumnarIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(exportGroupExpensesColumnar, STAT_BINARY);
+    binBuffer.clear();
+    GroupAccess found(eng, groupName);
+    if (!found) return nullptr;
+    const Group &g = *found;
+
+    size_t n = g.expenses.size() - g.tombstones;
+    size_t shareRows = g.shareMember.size() + g.equalMember.size() - g.deadShareRows;
+
+    vector<Money> amount, shareAmount;
+    vector<uint32_t> ids, name, category, payer, date, shareStart, shareMember;
+    amount.reserve(n); ids.reserve(n); shareStart.reserve(n + 1);
+    name.reserve(2 * n); category.reserve(2 * n); payer.reserve(2 * n); date.reserve(2 * n);
+    shareAmount.reserve(shareRows); shareMember.reserve(2 * shareRows);
+
+    StringTable strings;
+    for (auto &e : g.expenses) {
+        if (!e.live) continue;
+        ids.push_back(e.id);
+        amount.push_back(e.amount);
+        strings.ref(e.name, name);
+        strings.ref(e.category, category);
+        strings.ref(g.names[e.payer], payer);
+        strings.ref(e.date, date);
+        shareStart.push_back((uint32_t)shareAmount.size());
+        forEachShare(g, e, [&](uint32_t id, Money share) {
+            strings.ref(g.names[id], shareMember);
+            shareAmount.push_back(share);
+        });
+    }
+    shareStart.push_back((uint32_t)shareAmount.size());
+
+    uint32_t h[COL_HEADER_FIELDS] = {};
+    binBuffer.resize(sizeof h);
+    h[COL_MAGIC] = COL_MAGIC_VALUE;
+    h[COL_VERSION] = 2; // 2: amounts are int64 minor units
+    h[COL_EXPENSE_COUNT] = (uint32_t)n;
+    h[COL_SHARE_COUNT] = (uint32_t)shareAmount.size();
+    h[COL_AMOUNT_OFF] = appendColumn(binBuffer, amount.data(), amount.size());
+    h[COL_SHARE_AMOUNT_OFF] = appendColumn(binBuffer, shareAmount.data(), shareAmount.size());
+    h[COL_ID_OFF] = appendColumn(binBuffer, ids.data(), ids.size());
+    h[COL_NAME_OFF] = appendColumn(binBuffer, name.data(), name.size());
+    h[COL_CATEGORY_OFF] = appendColumn(binBuffer, category.data(), category.size());
+    h[COL_PAYER_OFF] = appendColumn(binBuffer, payer.data(), payer.size());
+    h[COL_DATE_OFF] = appendColumn(binBuffer, date.data(), date.size());
+    h[COL_SHARE_START_OFF] = appendColumn(binBuffer, shareStart.data(), shareStart.size());
+    h[COL_SHARE_MEMBER_OFF] = appendColumn(binBuffer, shareMember.data(), shareMember.size());
+    h[COL_STRINGS_OFF] = appendColumn(binBuffer, strings.bytes.data(), strings.bytes.size());
+    h[COL_STRINGS_SIZE] = (uint32_t)strings.bytes.size();
+    h[COL_TOTAL_SIZE] = (uint32_t)binBuffer.size();
+    memcpy(binBuffer.data(), h, sizeof h);
+    return binBuffer.data();
+}
+
+extern "C" int getLastBinarySize() {
+    return (int)binBuffer.size();
+}
+
+// -------------- Snapshots ----------------
+
+// saveSnapshot layout, little-endian: u32 magic "SSS1", u32 version, then
+//   varint stringCount, stringCount x (varint byteLength, UTF-8 bytes),
+//   varint groupCount, per group:
+//     ref name, varint nextId, varint rosterCount, rosterCount x ref,
+//     varint nameCount, nameCount x ref, varint rosterSize,
+//     varint expenseCount, per live expense:
+//       varint id, ref name, ref category, ref date, svarint amount, varint payer,
+//       varint memberCount, memberCount x (varint member, svarint share)
+//     then (version 2+) varint opHighWater (versions 2-4 only; ignored on load),
+//       varint docCount, docCount x (ref docId, varint id)
+//     then (version 3+) varint currencyCount, currencyCount x (ref code, varint rate),
+//       varint foreignCount, foreignCount x (varint id, varint currency, svarint original)
+//       for the live expenses entered in a currency other than the base
+//     then (version 4+) varint dupPolicy
+// where ref is an index into the string table, member/payer are name ids, amounts
+// are Money and svarint is a zigzag varint. Ledger, splits, indexes and rollups are
+// derived state, rebuilt on load in one pass over the expenses.
+static const uint32_t SNAP_MAGIC_VALUE = 0x31535353; // "SSS1"
+static const uint32_t SNAP_VERSION = 5; // 2: adds Firestore sync state, 3: currencies, 4: dedup policy,
+                                        // 5: drops the op high-water mark
+
+struct SnapshotWriter {
+    vector<unsigned char> &out;
+    unordered_map<string, uint32_t> refs;
+    vector<const string*> strings;
+
+    void varint(uint64_t v) {
+        while (v >= 0x80) { out.push_back((unsigned char)(v | 0x80)); v >>= 7; }
+        out.push_back((unsigned char)v);
+    }
+    void svarint(int64_t v) { varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); }
+    void ref(const string &s) {
+        auto it = refs.find(s);
+        if (it == refs.end()) {
+            it = refs.emplace(s, (uint32_t)strings.size()).first;
+            strings.push_back(&it->first);
+        }
+        varint(it->second);
+    }
+};
+
+struct SnapshotReader {
+    const unsigned char* p;
+    const unsigned char* end;
+    vector<string> strings;
+
+    bool varint(uint64_t &out) {
+        out = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            unsigned char b = *p++;
+            out |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+    bool u32(uint32_t &out) {
+        uint64_t v;
+        if (!varint(v) || v > UINT32_MAX) return false;
+        out = (uint32_t)v;
+        return true;
+    }
+    bool svarint(int64_t &out) {
+        uint64_t v;
+        if (!varint(v)) return false;
+        out = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        return true;
+    }
+    // A count of items encoded in at least minBytes each is bounded by the bytes left, so
+    // corrupt input cannot force reserves beyond what that many real items would need.
+    bool count(uint32_t &out, size_t minBytes = 1) { return u32(out) && out <= (size_t)(end - p) / minBytes; }
+    bool ref(string &out) {
+        uint32_t i;
+        if (!u32(i) || i >= strings.size()) return false;
+        out = strings[i];
+        return true;
+    }
+};
+
+static bool readSnapshotGroup(SnapshotReader &r, Group &g, uint32_t version) {
+    uint32_t n;
+    g.version = freshVersion();
+    if (!r.ref(g.name) || g.name.empty() || !r.u32(g.nextId) || !g.nextId || !r.count(n)) return false;
+    g.members.resize(n);
+    for (auto &m : g.members) if (!r.ref(m)) return false;
+    if (!r.count(n)) return false;
+    g.names.reserve(n);
+    g.ledger.assign(n, 0);
+    g.paid.assign(n, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        string name;
+        if (!r.ref(name) || g.nameIndex.find(g.names, name) != NameIndex::npos) return false;
+        g.names.push_back(std::move(name));
+        g.nameIndex.add(g.names, i);
+    }
+    // An expense takes at least 9 bytes: id, name, category, date, amount, payer, one share.
+    if (!r.u32(g.rosterSize) || g.rosterSize > n || !r.count(n, 9)) return false;
+
+    g.expenses.reserve(n);
+    uint32_t lastId = 0;
+    vector<uint32_t> ids;
+    vector<Money> shares;
+    for (uint32_t i = 0; i < n; ++i) {
+        Expense e;
+        uint32_t members;
+        if (!r.u32(e.id) || e.id <= lastId || e.id >= g.nextId) return false;
+        if (!r.ref(e.name) || !r.ref(e.category) || !r.ref(e.date) || !r.svarint(e.amount)) return false;
+        if (!r.u32(e.payer) || e.payer >= g.names.size() || !r.count(members, 2) || !members) return false;
+        ids.resize(members);
+        shares.resize(members);
+        for (uint32_t k = 0; k < members; ++k)
+            if (!r.u32(ids[k]) || ids[k] >= g.rosterSize || !r.svarint(shares[k])) return false;
+        appendSplit(g, e, ids, shares);
+        lastId = e.id;
+        indexExpense(g, e, 1);
+        appendExpense(g, std::move(e));
+    }
+    applyRangeToLedger(g, 0, 0);
+    if (version < 2) return true;
+
+    uint64_t highWater;
+    if ((version < 5 && !r.varint(highWater)) || !r.count(n, 2)) return false;
+    g.idByDoc.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        string doc;
+        uint32_t id;
+        if (!r.ref(doc) || !r.u32(id) || id >= g.slotById.size() || g.slotById[id] < 0) return false;
+        if (!g.idByDoc.emplace(std::move(doc), id).second) return false;
+    }
+    if (version < 3) return true;
+
+    if (!r.count(n, 2) || n > (uint32_t)UINT16_MAX + 1) return false;
+    g.currencies.resize(n);
+    for (auto &c : g.currencies) {
+        uint64_t rate;
+        if (!r.ref(c.code) || c.code.empty() || !r.varint(rate) || !rate || rate > (uint64_t)RATE_MAX) return false;
+        c.rate = (int64_t)rate;
+    }
+    if (!r.count(n, 3)) return false;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t id, currency;
+        Money original;
+        if (!r.u32(id) || id >= g.slotById.size() || g.slotById[id] < 0) return false;
+        if (!r.u32(currency) || !currency || currency >= g.currencies.size() || !r.svarint(original)) return false;
+        Expense &e = g.expenses[g.slotById[id]];
+        e.currency = (uint16_t)currency;
+        e.original = original;
+    }
+    if (version < 4) return true;
+
+    uint32_t policy;
+    if (!r.u32(policy) || policy > DUP_REJECT) return false;
+    g.dupPolicy = (DupPolicy)policy;
+    if (g.dupPolicy != DUP_OFF) buildDupIndex(g);
+    return true;
+}
+
+static void writeSnapshotGroup(SnapshotWriter &w, const Group &g) {
+    w.ref(g.name);
+    w.varint(g.nextId);
+    w.varint(g.members.size());
+    for (auto &m : g.members) w.ref(m);
+    w.varint(g.names.size());
+    for (auto &n : g.names) w.ref(n);
+    w.varint(g.rosterSize);
+    w.varint(g.expenses.size() - g.tombstones);
+    for (auto &e : g.expenses) {
+        if (!e.live) continue;
+        w.varint(e.id);
+        w.ref(e.name);
+        w.ref(e.category);
+        w.ref(e.date);
+        w.svarint(e.amount);
+        w.varint(e.payer);
+        w.varint(e.shareCount);
+        forEachShare(g, e, [&](uint32_t id, Money share) {
+            w.varint(id);
+            w.svarint(share);
+        });
+    }
+    // Only mappings to live expenses (deleteExpense can leave stale ones behind),
+    // in id order so equal states give identical blobs.
+    vector<pair<uint32_t, const string*>> docs;
+    for (auto &d : g.idByDoc)
+        if (g.slotById[d.second] >= 0) docs.push_back({d.second, &d.first});
+    sort(docs.begin(), docs.end());
+    w.varint(docs.size());
+    for (auto &d : docs) {
+        w.ref(*d.second);
+        w.varint(d.first);
+    }
+    w.varint(g.currencies.size());
+    for (auto &c : g.currencies) {
+        w.ref(c.code);
+        w.varint((uint64_t)c.rate);
+    }
+    size_t foreign = 0;
+    for (auto &e : g.expenses) foreign += e.live && e.currency;
+    w.varint(foreign);
+    for (auto &e : g.expenses) {
+        if (!e.live || !e.currency) continue;
+        w.varint(e.id);
+        w.varint(e.currency);
+        w.svarint(e.original);
+    }
+    w.varint(g.dupPolicy);
+}
+
+// Writes the header and string table for a body whose strings w collected.
+static void finishSnapshot(const SnapshotWriter &w, const vector<unsigned char> &body, vector<unsigned char> &out) {
+    out.clear();
+    const uint32_t head[2] = {SNAP_MAGIC_VALUE, SNAP_VERSION};
+    for (uint32_t v : head)
+        for (int i = 0; i < 4; ++i) out.push_back((unsigned char)(v >> (8 * i)));
+    SnapshotWriter table{out, {}, {}};
+    table.varint(w.strings.size());
+    for (auto* s : w.strings) {
+        table.varint(s->size());
+        out.insert(out.end(), s->begin(), s->end());
+    }
+    out.insert(out.end(), body.begin(), body.end());
+}
+
+// Parses a whole snapshot into loaded; returns an error message or nullptr.
+static const char* decodeSnapshot(const unsigned char* data, size_t size, vector<Group> &loaded) {
+    if (!data || size < 8) return "Malformed snapshot";
+    uint32_t head[2];
+    for (int k = 0; k < 2; ++k)
+        head[k] = (uint32_t)data[4 * k] | ((uint32_t)data[4 * k + 1] << 8) |
+                  ((uint32_t)data[4 * k + 2] << 16) | ((uint32_t)data[4 * k + 3] << 24);
+    if (head[0] != SNAP_MAGIC_VALUE) return "Malformed snapshot";
+    if (head[1] < 1 || head[1] > SNAP_VERSION) return "Unsupported snapshot version";
+
+    SnapshotReader r{data + 8, data + size, {}};
+    uint32_t n;
+    if (!r.count(n)) return "Malformed snapshot";
+    r.strings.resize(n);
+    for (auto &s : r.strings) {
+        uint32_t len;
+        if (!r.count(len)) return "Malformed snapshot";
+        s.assign((const char*)r.p, len);
+        r.p += len;
+    }
+
+    // A group takes at least 6 bytes (name, nextId and four empty counts) but about 1 KB
+    // in memory, so groups are added as they decode rather than reserved up front.
+    if (!r.count(n, 6)) return "Malformed snapshot";
+    for (uint32_t i = 0; i < n; ++i) {
+        loaded.emplace_back();
+        if (!readSnapshotGroup(r, loaded.back(), head[1])) return "Malformed snapshot";
+    }
+    if (r.p != r.end) return "Malformed snapshot";
+    for (size_t i = 1; i < loaded.size(); ++i)
+        if (loaded[i - 1].name >= loaded[i].name) return "Malformed snapshot";
+    return nullptr;
+}
+
+static const unsigned char* saveSnapshotIn(SsEngine &eng) {
+    STAT_SCOPE(saveSnapshot, STAT_BINARY);
+    // Live and spilled groups in one name order; spilled ones are decoded one at a
+    // time, since the writer keeps its own copies of the strings it has seen.
+    vector<pair<const string*, const Group*>> sorted;
+    shared_lock<shared_mutex> tableLock(eng.lock);
+    sorted.reserve(eng.groups.size() + eng.spilled.size());
+    eng.groups.forEach([&](const Group &g) { sorted.push_back({&g.name, &g}); });
+    for (auto &s : eng.spilled) sorted.push_back({&s.first, nullptr});
+    sort(sorted.begin(), sorted.end(), [](const pair<const string*, const Group*> &a,
+                                          const pair<const string*, const Group*> &b) { return *a.first < *b.first; });
+
+    vector<unsigned char> body;
+    SnapshotWriter w{body, {}, {}};
+    w.varint(sorted.size());
+    for (auto &entry : sorted) {
+        if (entry.second) {
+            lock_guard<mutex> hold(entry.second->lock.m);
+            writeSnapshotGroup(w, *entry.second);
+        } else {
+            const vector<unsigned char> &blob = eng.spilled.find(*entry.first)->second;
+            vector<Group> one;
+            decodeSnapshot(blob.data(), blob.size(), one); // our own blob, written by evictColdGroups
+            writeSnapshotGroup(w, one[0]);
+        }
+    }
+    finishSnapshot(w, body, binBuffer);
+    return binBuffer.data();
+}
+
+static const char* loadSnapshotIn(SsEngine &eng, const unsigned char* data, int size) {
+    STAT_SCOPE(loadSnapshot, STAT_JSON);
+    // Parse everything before touching live state, so a bad blob leaves it intact.
+    vector<Group> loaded;
+    const char* err = decodeSnapshot(data, size > 0 ? (size_t)size : 0, loaded);
+    if (err) return errorJson(err);
+    size_t expenses = 0;
+    for (auto &g : loaded) expenses += g.expenses.size();
+
+    unique_lock<shared_mutex> tableLock(eng.lock);
+    eng.groups.clear();
+    eng.spilled.clear();
+    eng.spilledBytes = 0;
+    eng.liveBytes = 0;
+    for (auto &g : loaded) {
+        Group &placed = *eng.groups.insert(g.name) = std::move(g);
+        placed.lastUse = ++eng.useClock;
+        accountGroup(eng, placed);
+    }
+    evictColdGroups(eng);
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"groups\":").uint(loaded.size()).raw(",\"expenses\":").uint(expenses).raw('}');
+    return w.c_str();
+}
+
+static void clearAllDataIn(SsEngine &eng) {
+    STAT_SCOPE(clearAllData, STAT_VOID);
+    unique_lock<shared_mutex> tableLock(eng.lock);
+    eng.groups.clear();
+    eng.spilled.clear();
+    eng.spilledBytes = 0;
+    eng.liveBytes = 0;
+}
+
+// -------------- Memory Budget ----------------
+
+// Evicts least recently used groups until the engine is back under 7/8 of its budget
+// (the slack keeps a steady stream of calls from evicting on every one). The most
+// recently used group always stays, however large.
+static void evictColdGroups(SsEngine &eng) {
+    if (!overBudget(eng)) return;
+    int64_t target = (int64_t)(eng.budget.load(memory_order_relaxed) / 8 * 7);
+    vector<pair<uint64_t, Group*>> byAge;
+    byAge.reserve(eng.groups.size());
+    eng.groups.forEach([&](const Group &g) { byAge.push_back({g.lastUse, const_cast<Group*>(&g)}); });
+    sort(byAge.begin(), byAge.end(), [](const pair<uint64_t, Group*> &a, const pair<uint64_t, Group*> &b) {
+        return a.first < b.first;
+    });
+
+    for (size_t i = 0; i + 1 < byAge.size() && eng.liveBytes.load() > target; ++i) {
+        Group &g = *byAge[i].second;
+        if (g.import.active) continue;
+        if (eng.spill) {
+            vector<unsigned char> body;
+            SnapshotWriter w{body, {}, {}};
+            w.varint(1);
+            writeSnapshotGroup(w, g);
+            vector<unsigned char> &blob = eng.spilled[g.name];
+            finishSnapshot(w, body, blob);
+            blob.shrink_to_fit();
+            eng.spilledBytes += blob.size();
+        }
+        eng.liveBytes -= (int64_t)g.accountedBytes;
+        string name = g.name;
+        eng.groups.erase(name);
+    }
+}
+
+static void reloadSpilled(SsEngine &eng, string_view name) {
+    auto it = eng.spilled.find(name);
+    if (it == eng.spilled.end()) return; // another thread got here first
+    vector<Group> one;
+    decodeSnapshot(it->second.data(), it->second.size(), one);
+    eng.spilledBytes -= it->second.size();
+    eng.spilled.erase(it);
+    Group &g = *eng.groups.insert(one[0].name) = std::move(one[0]);
+    g.lastUse = ++eng.useClock;
+    accountGroup(eng, g);
+}
+
+static const char* setMemoryBudgetIn(SsEngine &eng, int budgetKb, int spill) {
+    unique_lock<shared_mutex> tableLock(eng.lock);
+    eng.budget = budgetKb > 0 ? (size_t)budgetKb * 1024 : 0;
+    eng.spill = spill != 0;
+    size_t before = eng.groups.size();
+    evictColdGroups(eng);
+
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"ok\":true,\"evicted\":").uint(before - eng.groups.size()).raw('}');
+    return w.c_str();
+}
+
+static const char* deleteGroupIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(deleteGroup, STAT_JSON);
+    unique_lock<shared_mutex> tableLock(eng.lock);
+    Group* g = eng.groups.find(groupName);
+    if (g) {
+        eng.liveBytes -= (int64_t)g->accountedBytes;
+        eng.groups.erase(groupName);
+        return makeJson("{\"ok\":true}");
+    }
+    auto it = eng.spilled.find(groupName);
+    if (it == eng.spilled.end()) return makeJson("{\"error\":\"Group not found\"}");
+    eng.spilledBytes -= it->second.size();
+    eng.spilled.erase(it);
+    return makeJson("{\"ok\":true}");
+}
+// -------------- Settlement ----------------
+
+struct Balance {
+    uint32_t id;
+    Money amount; // > 0 is owed to the member, < 0 is owed by them
+};
+
+typedef chrono::steady_clock SettleClock;
+
+// Non-zero ledger entries in name order, which is the pairing order greedy relies on.
+// names maps each ledger index to its name (Group::names, or a what-if extension of it).
+template <typename Names>
+static vector<Balance> openBalances(const vector<Money> &ledger, const Names &names) {
+    vector<Balance> out;
+    for (uint32_t k = 0; k < ledger.size(); ++k)
+        if (ledger[k] != 0) out.push_back({k, ledger[k]});
+    sort(out.begin(), out.end(), [&](const Balance &a, const Balance &b) { return names[a.id] < names[b.id]; });
+    return out;
+}
+
+// Two-pointer walk over debtors and creditors in name order. O(n), at most n - 1 transfers.
+static void settleGreedy(const vector<Balance> &balances, vector<Transfer> &out) {
+    vector<Balance> debtors, creditors;
+    for (auto &b : balances) {
+        if (b.amount < 0) debtors.push_back({b.id, -b.amount});
+        else creditors.push_back(b);
+    }
+
+    size_t i = 0, j = 0;
+    while (i < debtors.size() && j < creditors.size()) {
+        Money pay = min(debtors[i].amount, creditors[j].amount);
+        out.push_back({debtors[i].id, creditors[j].id, pay});
+        debtors[i].amount -= pay;
+        creditors[j].amount -= pay;
+        if (debtors[i].amount == 0) ++i;
+        if (creditors[j].amount == 0) ++j;
+    }
+}
+
+// Always settles the largest debt against the largest credit. O(n log n); tends to
+// close out big balances in one transfer, which greedy name order often splits.
+static void settleHeap(const vector<Balance> &balances, vector<Transfer> &out) {
+    // balances arrive in name order, so the index breaks ties by name.
+    typedef pair<Money, int> Entry; // (amount, -index)
+    priority_queue<Entry> debtors, creditors;
+    for (int k = 0; k < (int)balances.size(); ++k) {
+        if (balances[k].amount < 0) debtors.push({-balances[k].amount, -k});
+        else creditors.push({balances[k].amount, -k});
+    }
+
+    while (!debtors.empty() && !creditors.empty()) {
+        Entry d = debtors.top(), c = creditors.top();
+        debtors.pop(); creditors.pop();
+        Money pay = min(d.first, c.first);
+        out.push_back({balances[-d.second].id, balances[-c.second].id, pay});
+        if (d.first > pay) debtors.push({d.first - pay, d.second});
+        if (c.first > pay) creditors.push({c.first - pay, c.second});
+    }
+}
+
+static const int EXACT_MAX_MEMBERS = 20;
+
+// Minimum number of transfers. Any set of balances summing to zero can be settled
+// in (size - 1) transfers, so the optimum is n minus the largest number of disjoint
+// zero-sum subsets; dp[mask] holds that count over bitmask subsets. Exact opposite
+// pairs are matched up front since some optimal solution always keeps them.
+// Returns false (with out untouched) if the deadline passes or n is too large.
+static bool settleExact(const vector<Balance> &balances, vector<Transfer> &out,
+                        SettleClock::time_point deadline, bool hasDeadline) {
+    vector<Transfer> paired;
+    vector<Balance> rest;
+    vector<bool> used(balances.size(), false);
+    unordered_map<Money, vector<size_t>> byAmount;
+    for (size_t k = 0; k < balances.size(); ++k) {
+        auto it = byAmount.find(-balances[k].amount);
+        if (it != byAmount.end() && !it->second.empty()) {
+            size_t other = it->second.back();
+            it->second.pop_back();
+            used[k] = used[other] = true;
+            const Balance &a = balances[k], &b = balances[other];
+            if (a.amount < 0) paired.push_back({a.id, b.id, b.amount});
+            else paired.push_back({b.id, a.id, a.amount});
+        } else {
+            byAmount[balances[k].amount].push_back(k);
+        }
+    }
+    for (size_t k = 0; k < balances.size(); ++k)
+        if (!used[k]) rest.push_back(balances[k]);
+
+    const int n = (int)rest.size();
+    if (n > EXACT_MAX_MEMBERS) return false;
+
+    vector<Transfer> result = paired;
+    if (n > 0) {
+        const uint32_t full = (1u << n) - 1;
+        vector<Money> sum((size_t)full + 1, 0);
+        vector<uint8_t> dp((size_t)full + 1, 0);
+        for (uint32_t mask = 1; mask <= full; ++mask) {
+            if ((mask & 0xFFF) == 0 && hasDeadline && SettleClock::now() > deadline) return false;
+            uint32_t low = mask & (0 - mask);
+            sum[mask] = sum[mask ^ low] + rest[__builtin_ctz(low)].amount;
+            uint8_t best = 0;
+            for (uint32_t m = mask; m; m &= m - 1) {
+                uint8_t v = dp[mask ^ (m & (0 - m))];
+                if (v > best) best = v;
+            }
+            dp[mask] = best + (sum[mask] == 0 ? 1 : 0);
+        }
+
+        // Peel members off along an optimal path; each time the remaining mask
+        // sums to zero, the members peeled since the last cut form one subset.
+        vector<Balance> subset;
+        uint32_t mask = full;
+        while (mask) {
+            uint8_t target = dp[mask] - (sum[mask] == 0 ? 1 : 0);
+            uint32_t m = mask, bit = 0;
+            for (; m; m &= m - 1) {
+                bit = m & (0 - m);
+                if (dp[mask ^ bit] == target) break;
+            }
+            subset.push_back(rest[__builtin_ctz(bit)]);
+            mask ^= bit;
+            if (sum[mask] == 0) {
+                settleHeap(subset, result);
+                subset.clear();
+            }
+        }
+    }
+    out.insert(out.end(), result.begin(), result.end());
+    return true;
+}
+
+static bool knownStrategy(string_view mode) {
+    return mode == "greedy" || mode == "heap" || mode == "exact";
+}
+
+// Runs the named strategy; returns the strategy that actually ran ("exact" may fall
+// back to "heap"), or nullptr if the name is unknown.
+static const char* settleWith(const vector<Balance> &balances, string_view mode, int timeBudgetMs,
+                              vector<Transfer> &out) {
+    if (mode == "greedy") {
+        settleGreedy(balances, out);
+        return "greedy";
+    }
+    if (mode == "heap") {
+        settleHeap(balances, out);
+        return "heap";
+    }
+    if (mode == "exact") {
+        auto deadline = SettleClock::now() + chrono::milliseconds(timeBudgetMs);
+        if (settleExact(balances, out, deadline, timeBudgetMs > 0)) return "exact";
+        out.clear();
+        settleHeap(balances, out);
+        return "heap";
+    }
+    return nullptr;
+}
+
+template <typename Names>
+static void writeTransfers(JsonWriter &w, const Names &names, const vector<Transfer> &settlements) {
+    w.raw("\"settlements\":[");
+    bool first = true;
+    for (auto &t : settlements) {
+        w.sep(first).raw("{\"from\":").str(names[t.from]).raw(",\"to\":").str(names[t.to])
+         .raw(",\"amount\":").money(t.amount).raw('}');
+    }
+    w.raw(']');
+}
+
+static const char* settlementJson(const Group &g, const vector<Transfer> &settlements, const char* strategy) {
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"group\":").str(g.name).raw(',');
+    if (strategy) w.raw("\"strategy\":").str(strategy, strlen(strategy)).raw(',');
+    writeTransfers(w, g.names, settlements);
+    w.raw('}');
+    return w.c_str();
+}
+
+// Fills jsonBuffer with g's settlement for strategy (empty: calculateGroupSettlement's
+// greedy form without a "strategy" field), from the cache when g is unchanged since it
+// was computed. Returns nullptr for an unknown strategy.
+static const char* cachedSettlement(Group &g, string_view strategy, int timeBudgetMs) {
+    if (!strategy.empty() && !knownStrategy(strategy)) return nullptr;
+    if (strategy != "exact") timeBudgetMs = 0;
+    SettlementCache &c = g.settled;
+    if (c.version == g.version && c.strategy == strategy && c.timeBudgetMs == timeBudgetMs) {
+        jsonBuffer.assign(c.json);
+        return jsonBuffer.c_str();
+    }
+
+    c.transfers.clear();
+    const char* ran = nullptr;
+    if (strategy.empty()) settleGreedy(openBalances(g.ledger, g.names), c.transfers);
+    else ran = settleWith(openBalances(g.ledger, g.names), strategy, timeBudgetMs, c.transfers);
+    settlementJson(g, c.transfers, ran);
+    c.json.assign(jsonBuffer);
+    c.version = g.version;
+    c.strategy.assign(strategy.data(), strategy.size());
+    c.timeBudgetMs = timeBudgetMs;
+    return jsonBuffer.c_str();
+}
+
+static const char* getGroupBalancesIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(getGroupBalances, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+
+    JsonWriter w(jsonBuffer);
+    w.reserve(64 + g.names.size() * 80);
+    w.raw("{\"group\":").str(groupName);
+    if (!g.currencies.empty()) w.raw(",\"currency\":").str(g.currencies[0].code);
+    w.raw(",\"balances\":[");
+    bool first = true;
+    for (uint32_t k = 0; k < g.names.size(); ++k) {
+        w.sep(first).raw("{\"name\":").str(g.names[k]).raw(",\"paid\":").money(g.paid[k])
+         .raw(",\"share\":").money(g.paid[k] - g.ledger[k]).raw(",\"balance\":").money(g.ledger[k]).raw('}');
+    }
+    w.raw("]}");
+    return w.c_str();
+}
+
+static const char* calculateGroupSettlementIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(calculateGroupSettlement, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    return cachedSettlement(*found, string_view(), 0);
+}
+
+static const char* calculateGroupSettlementWithIn(SsEngine &eng, string_view groupName, string_view strategy,
+                                                  int timeBudgetMs) {
+    STAT_SCOPE(calculateGroupSettlementWith, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    if (strategy.empty()) return makeJson("{\"error\":\"Unknown strategy\"}");
+    const char* json = cachedSettlement(*found, strategy, timeBudgetMs);
+    return json ? json : makeJson("{\"error\":\"Unknown strategy\"}");
+}
+
+static const char* getGroupVersionIn(SsEngine &eng, string_view groupName) {
+    STAT_SCOPE(getGroupVersion, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"group\":").str(groupName).raw(",\"version\":\"").uint(found->version).raw("\"}");
+    return w.c_str();
+}
+
+// -------------- What-if Settlement ----------------
+
+static const size_t CHECKPOINT_BUDGET = 1 << 18; // Money entries in a group's checkpoint table
+
+// Adds e to a balance vector indexed like g.ledger, as applyToLedger does for g.ledger.
+static void addToBalances(const Group &g, const Expense &e, vector<Money> &ledger) {
+    forEachShare(g, e, [&](uint32_t id, Money share) { ledger[id] -= share; });
+    ledger[e.payer] += e.amount;
+}
+
+static void addBucket(const Group &g, const vector<uint32_t> &ids, vector<Money> &ledger) {
+    for (uint32_t id : ids) addToBalances(g, g.expenses[g.slotById[id]], ledger);
+}
+
+// Brings the table up to date: extends it from its last row over the dates after it,
+// O(expenses on those dates + new rows * names). Names added since the last call get
+// zero columns, as no earlier row can involve them.
+static const LedgerCheckpoints &ledgerCheckpoints(Group &g) {
+    LedgerCheckpoints &c = g.checkpoints;
+    const size_t width = g.names.size();
+    if (c.dates.empty() || c.width > width) {
+        c.dates.clear();
+        c.rows.clear();
+        c.width = width;
+        c.stride = max<size_t>(1, (g.byDate.size() * width + CHECKPOINT_BUDGET - 1) / CHECKPOINT_BUDGET);
+    } else if (c.width < width) {
+        vector<Money> wider(c.dates.size() * width, 0);
+        for (size_t k = 0; k < c.dates.size(); ++k)
+            copy_n(c.rows.begin() + k * c.width, c.width, wider.begin() + k * width);
+        c.rows.swap(wider);
+        c.width = width;
+    }
+
+    vector<Money> running(width, 0);
+    if (!c.dates.empty()) copy(c.rows.end() - width, c.rows.end(), running.begin());
+    auto it = c.dates.empty() ? g.byDate.begin() : g.byDate.upper_bound(c.dates.back());
+    for (size_t n = 1; it != g.byDate.end(); ++it, ++n) {
+        addBucket(g, it->second, running);
+        if (n % c.stride) continue;
+        c.dates.push_back(it->first);
+        c.rows.insert(c.rows.end(), running.begin(), running.end());
+        n = 0;
+        // Row k covers (k + 1) * stride dates, so rows 1, 3, 5, ... are the rows of twice
+        // the stride; with an even count the last row survives and n stays aligned.
+        if (c.rows.size() > 2 * CHECKPOINT_BUDGET && c.dates.size() % 2 == 0) {
+            for (size_t k = 1, to = 0; k < c.dates.size(); k += 2, ++to) {
+                c.dates[to] = std::move(c.dates[k]);
+                copy_n(c.rows.begin() + k * width, width, c.rows.begin() + to * width);
+            }
+            c.dates.resize(c.dates.size() / 2);
+            c.rows.resize(c.dates.size() * width);
+            c.stride *= 2;
+        }
+    }
+    return c;
+}
+
+// g's balances over the expenses dated on or before asOf (every expense when empty):
+// the nearest checkpoint at or below the cutoff plus fewer than stride date buckets.
+static void balancesAsOf(Group &g, string_view asOf, vector<Money> &out) {
+    if (asOf.empty()) {
+        out = g.ledger;
+        return;
+    }
+    const LedgerCheckpoints &c = ledgerCheckpoints(g);
+    size_t rows = upper_bound(c.dates.begin(), c.dates.end(), asOf) - c.dates.begin();
+    if (rows) out.assign(c.rows.begin() + (rows - 1) * c.width, c.rows.begin() + rows * c.width);
+    else out.assign(c.width, 0);
+    auto it = rows ? g.byDate.upper_bound(c.dates[rows - 1]) : g.byDate.begin();
+    for (; it != g.byDate.end() && string_view(it->first) <= asOf; ++it) addBucket(g, it->second, out);
+}
+
+// Adds a hypothetical expense to ledger without touching g. A payer g has never seen
+// is appended to both ledger and names. Returns an error message or nullptr.
+static const char* addWhatIf(const Group &g, ExpenseInput &in, vector<Money> &ledger, vector<string_view> &names) {
+    static thread_local vector<uint32_t> ids;
+    if (in.invalid) return in.invalid;
+    if (in.members.empty()) return "Members empty";
+    if (!validateMembersInGroup(g, in.members, ids)) return "Invalid member(s)";
+    if (!in.shares.empty() && in.shares.size() != in.members.size()) return "Share count mismatch";
+    const char* err;
+    toBaseCurrency(g, in, err);
+    if (err) return err;
+
+    uint32_t payer = g.nameIndex.find(g.names, in.payer);
+    if (payer == NameIndex::npos) {
+        payer = (uint32_t)(find(names.begin() + g.names.size(), names.end(), in.payer) - names.begin());
+        if (payer == names.size()) {
+            names.push_back(in.payer);
+            ledger.push_back(0);
+        }
+    }
+    ledger[payer] += in.amount;
+    const uint32_t n = (uint32_t)ids.size();
+    for (uint32_t i = 0; i < n; ++i) ledger[ids[i]] -= in.shares.empty() ? equalShare(in.amount, n, i) : in.shares[i];
+    return nullptr;
+}
+
+static const char* calculateSettlementAsOfIn(SsEngine &eng, string_view groupName, string_view asOf,
+                                             string_view strategy, int timeBudgetMs,
+                                             const unsigned char* data, int size) {
+    STAT_SCOPE(calculateSettlementAsOf, STAT_JSON);
+    GroupAccess found(eng, groupName);
+    if (!found) return makeJson("{\"error\":\"Group not found\"}");
+    Group &g = *found;
+    if (!knownStrategy(strategy)) return makeJson("{\"error\":\"Unknown strategy\"}");
+    if ((!data && size) || size < 0) return makeJson("{\"error\":\"Malformed batch\"}");
+
+    vector<Money> ledger;
+    balancesAsOf(g, asOf, ledger);
+    vector<string_view> names(g.names.begin(), g.names.end());
+    uint32_t count = 0, added = 0;
+    BatchReader r{data, data + size};
+    if (size && !r.u32(count)) return makeJson("{\"error\":\"Malformed batch\"}");
+    for (uint32_t i = 0; i < count; ++i) {
+        ExpenseInput in;
+        const char* err = readBatchExpense(r, in) ? nullptr : "Malformed batch";
+        if (!err && !asOf.empty() && string_view(in.date) > asOf) continue;
+        if (!err) err = addWhatIf(g, in, ledger, names);
+        if (err) {
+            JsonWriter w(jsonBuffer);
+            w.raw("{\"error\":").str(err, strlen(err)).raw(",\"index\":").uint(i).raw('}');
+            return w.c_str();
+        }
+        ++added;
+    }
+
+    vector<Transfer> settlements;
+    const char* ran = settleWith(openBalances(ledger, names), strategy, timeBudgetMs, settlements);
+    JsonWriter w(jsonBuffer);
+    w.raw("{\"group\":").str(g.name).raw(",\"strategy\":").str(ran, strlen(ran))
+     .raw(",\"asOf\":").str(asOf).raw(",\"hypothetical\":").uint(added).raw(',');
+    writeTransfers(w, names, settlements);
+    w.raw('}');
+    return w.c_str();
+}
+
+// -------------- Batch Settlement ----------------
+
+// Native builds and Emscripten builds with -pthread run the batch on real threads;
+// a single-threaded WASM build settles serially.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+static const bool HAVE_THREADS = false;
+#else
+static const bool HAVE_THREADS = true;
+#endif
+
+// Worker threads kept for the life of the process, started on the first parallel batch
+// and added as later calls ask for more, so a batch does not pay for thread creation
+// (nor, under Emscripten, take fresh workers from the pthread pool). Engines share it;
+// jobs run one at a time.
+class WorkerPool {
+public:
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> hold(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : workers) t.join();
+    }
+
+    // Runs work(k) for k in [0, participants), k = 0 on the calling thread, and returns
+    // once every participant has.
+    void run(unsigned participants, const function<void(unsigned)> &work) {
+        lock_guard<mutex> serial(jobLock);
+        {
+            lock_guard<mutex> hold(m);
+            while (workers.size() + 1 < participants) {
+                unsigned self = (unsigned)workers.size() + 1;
+                workers.emplace_back([this, self] { loop(self); });
+            }
+            job = &work;
+            active = participants;
+            pending = participants - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        work(0);
+        unique_lock<mutex> hold(m);
+        done.wait(hold, [&] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    void loop(unsigned self) {
+        uint64_t seen = 0;
+        unique_lock<mutex> hold(m);
+        for (;;) {
+            wake.wait(hold, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (self >= active) continue;
+            const function<void(unsigned)> &work = *job;
+            hold.unlock();
+            work(self);
+            hold.lock();
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+    mutex jobLock; // one job at a time
+    mutex m;
+    condition_variable wake, done;
+    vector<thread> workers; // worker k (from 1) runs participant k
+    const function<void(unsigned)>* job = nullptr;
+    unsigned active = 0, pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+static WorkerPool &workerPool() {
+    static WorkerPool pool;
+    return pool;
+}
+
+// Runs task(i) for every i in [0, count) on up to `threads` threads, the caller included.
+// Each worker starts with a contiguous slice in its own deque, pops from the back of it,
+// and once it runs dry steals from the front of the others, so a few huge groups do not
+// leave the remaining cores idle.
+template <typename F>
+static void parallelFor(size_t count, unsigned threads, F task) {
+    if (threads > count) threads = (unsigned)count;
+    if (!HAVE_THREADS || threads <= 1) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+
+    struct WorkQueue {
+        mutex m;
+        deque<size_t> items;
+    };
+    vector<WorkQueue> queues(threads);
+    for (size_t i = 0; i < count; ++i) queues[i * threads / count].items.push_back(i);
+
+    auto next = [&](unsigned self, size_t &out) {
+        {
+            WorkQueue &own = queues[self];
+            lock_guard<mutex> hold(own.m);
+            if (!own.items.empty()) {
+                out = own.items.back();
+                own.items.pop_back();
+                return true;
+            }
+        }
+        for (unsigned k = 1; k < threads; ++k) {
+            WorkQueue &victim = queues[(self + k) % threads];
+            lock_guard<mutex> hold(victim.m);
+            if (!victim.items.empty()) {
+                out = victim.items.front();
+                victim.items.pop_front();
+                return true;
+            }
+        }
+        return false; // nothing is ever re-queued, so empty everywhere means done
+    };
+    auto work = [&](unsigned self) {
+        size_t i;
+        while (next(self, i)) task(i);
+    };
+
+    workerPool().run(threads, work);
+}
+
+static const char* calculateSettlementsBatchIn(SsEngine &eng, string_view groupList, string_view strategy,
+                                               int timeBudgetMs, int threads) {
+    STAT_SCOPE(calculateSettlementsBatch, STAT_JSON);
+    string_view mode = strategy;
+    if (!knownStrategy(mode)) return makeJson("{\"error\":\"Unknown strategy\"}");
+
+    // "*" copies the names out, since groups may be removed once the table lock drops.
+    vector<string> all;
+    vector<string_view> names;
+    if (groupList == "*") {
+        shared_lock<shared_mutex> tableLock(eng.lock);
+        all.reserve(eng.groups.size() + eng.spilled.size());
+        eng.groups.forEach([&](const Group &g) { all.push_back(g.name); });
+        for (auto &s : eng.spilled) all.push_back(s.first);
+        sort(all.begin(), all.end());
+        names.assign(all.begin(), all.end());
+    } else {
+        splitPipe(groupList, names);
+    }
+
+    // Workers look groups up by name themselves: holding the table lock here while
+    // they run could deadlock against a writer queued in between.
+    unsigned n = threads > 0 ? (unsigned)threads : thread::hardware_concurrency();
+    vector<string> results(names.size());
+    parallelFor(names.size(), n ? n : 1, [&](size_t i) {
+        GroupAccess found(eng, names[i]);
+        if (!found) {
+            JsonWriter w(jsonBuffer);
+            w.raw("{\"group\":").str(names[i]).raw(",\"error\":\"Group not found\"}");
+        } else {
+            cachedSettlement(*found, mode, timeBudgetMs);
+        }
+        results[i] = jsonBuffer; // this worker's thread_local buffer
+    });
+
+    size_t total = 64;
+    for (auto &r : results) total += r.size() + 1;
+    JsonWriter w(jsonBuffer);
+    w.reserve(total);
+    w.raw("{\"strategy\":").str(mode).raw(",\"groups\":[");
+    bool first = true;
+    for (auto &r : results) w.sep(first).raw(r.data(), r.size());
+    w.raw("]}");
+    return w.c_str();
+}
+
+// -------------- Engine Stats ----------------
+
+// Heap bytes behind a string, assuming short strings live inline.
+static size_t stringHeapBytes(const string &s) {
+    return s.capacity() >= sizeof(string) ? s.capacity() + 1 : 0;
+}
+
+// Estimated heap footprint of a group: container capacities plus string payloads, with
+// each map node counted as its value plus a typical node header.
+static size_t groupMemoryBytes(const Group &g) {
+    const size_t treeNode = 4 * sizeof(void*), hashNode = 2 * sizeof(void*);
+    size_t bytes = g.expenses.capacity() * sizeof(Expense) + g.slotById.capacity() * sizeof(int32_t);
+    for (auto &e : g.expenses) bytes += stringHeapBytes(e.name) + stringHeapBytes(e.category) + stringHeapBytes(e.date);
+    bytes += (g.shareMember.capacity() + g.equalMember.capacity()) * sizeof(uint32_t);
+    bytes += g.shareAmount.capacity() * sizeof(Money);
+    for (auto &m : g.members) bytes += sizeof(string) + stringHeapBytes(m);
+    bytes += g.names.capacity() * sizeof(string) + (g.ledger.capacity() + g.paid.capacity()) * sizeof(Money);
+    for (auto &n : g.names) bytes += stringHeapBytes(n);
+    bytes += g.nameIndex.heapBytes() + g.currencies.capacity() * sizeof(Currency);
+    for (auto &c : g.currencies) bytes += stringHeapBytes(c.code);
+    if (!g.nameIndex.isInline())
+        for (auto &n : g.names) bytes += stringHeapBytes(n);
+    for (auto &kv : g.byDate) bytes += treeNode + sizeof(kv) + stringHeapBytes(kv.first) + kv.second.capacity() * sizeof(uint32_t);
+    bytes += g.byCategory.bucket_count() * sizeof(void*);
+    for (auto &kv : g.byCategory) bytes += hashNode + sizeof(kv) + stringHeapBytes(kv.first) + kv.second.capacity() * sizeof(uint32_t);
+    bytes += g.byPayer.capacity() * sizeof(vector<uint32_t>);
+    for (auto &list : g.byPayer) bytes += list.capacity() * sizeof(uint32_t);
+    for (auto &kv : g.categoryByMonth)
+        bytes += treeNode + sizeof(kv) + stringHeapBytes(kv.first.first) + stringHeapBytes(kv.first.second);
+    for (auto &kv : g.memberByMonth) bytes += treeNode + sizeof(kv) + stringHeapBytes(kv.first.first);
+    bytes += g.idByDoc.bucket_count() * sizeof(void*);
+    for (auto &kv : g.idByDoc) bytes += hashNode + sizeof(kv) + stringHeapBytes(kv.first);
+    bytes += g.dupIndex.bucket_count() * sizeof(void*) + g.dupIndex.size() * (hashNode + sizeof(pair<uint64_t, uint32_t>));
+    bytes += g.import.pending.capacity();
+    bytes += g.settled.transfers.capacity() * sizeof(Transfer) + stringHeapBytes(g.settled.json);
+    bytes += g.checkpoints.dates.capacity() * sizeof(string) + g.checkpoints.rows.capacity() * sizeof(Money);
+    for (auto &d : g.checkpoints.dates) bytes += stringHeapBytes(d);
+    return bytes;
+}
+
+static const char* getEngineStatsIn(SsEngine &eng, int reset) {
+    JsonWriter w(jsonBuffer);
+    {
+        vector<pair<const Group*, size_t>> groups;
+        shared_lock<shared_mutex> tableLock(eng.lock);
+        groups.reserve(eng.groups.size());
+        eng.groups.forEach([&](const Group &g) {
+            lock_guard<mutex> hold(g.lock.m);
+            groups.push_back({&g, groupMemoryBytes(g)});
+        });
+        sort(groups.begin(), groups.end(), [](const pair<const Group*, size_t> &a, const pair<const Group*, size_t> &b) {
+            return a.first->name < b.first->name;
+        });
+
+        size_t totalBytes = 0, expenses = 0;
+        w.raw("{\"groups\":[");
+        bool first = true;
+        for (auto &gb : groups) {
+            size_t live = gb.first->expenses.size() - gb.first->tombstones;
+            totalBytes += gb.second;
+            expenses += live;
+            w.sep(first).raw("{\"group\":").str(gb.first->name).raw(",\"expenses\":").uint(live)
+             .raw(",\"bytes\":").uint(gb.second).raw('}');
+        }
+        w.raw("],\"totalExpenses\":").uint(expenses).raw(",\"totalBytes\":").uint(totalBytes)
+         .raw(",\"budgetBytes\":").uint(eng.budget.load()).raw(",\"budgetedBytes\":").uint((uint64_t)max<int64_t>(eng.liveBytes.load(), 0))
+         .raw(",\"spilledGroups\":").uint(eng.spilled.size()).raw(",\"spilledBytes\":").uint(eng.spilledBytes);
+    }
+
+#ifdef SPENDSENSE_STATS
+    // With reset, each counter is read and zeroed in one step, so calls finishing
+    // meanwhile land in either this report or the next one.
+    auto take = [&](atomic<uint64_t> &a) { return reset ? a.exchange(0, memory_order_relaxed) : a.load(memory_order_relaxed); };
+    w.raw(",\"enabled\":true,\"calls\":[");
+    bool first = true;
+    for (size_t op = 0; op < STAT_OP_COUNT; ++op) {
+        OpStats &s = opStats[op];
+        uint64_t latency[LATENCY_BUCKETS], counted = 0;
+        for (size_t b = 0; b < LATENCY_BUCKETS; ++b) counted += latency[b] = take(s.latency[b]);
+        uint64_t calls = take(s.calls), totalNs = take(s.totalNs);
+        uint64_t bytes = take(s.resultBytes), allocs = take(s.allocs);
+        if (!calls) continue;
+
+        uint64_t seen = 0, p50 = 0, p99 = 0;
+        for (size_t b = 0; b < LATENCY_BUCKETS && !p99; ++b) {
+            seen += latency[b];
+            if (!p50 && seen * 2 >= counted) p50 = bucketUpperNs(b);
+            if (seen * 100 >= counted * 99) p99 = bucketUpperNs(b);
+        }
+        w.sep(first).raw("{\"op\":").str(STAT_OP_NAMES[op], strlen(STAT_OP_NAMES[op]))
+         .raw(",\"calls\":").uint(calls).raw(",\"totalNs\":").uint(totalNs)
+         .raw(",\"p50Ns\":").uint(p50).raw(",\"p99Ns\":").uint(p99)
+         .raw(",\"resultBytes\":").uint(bytes).raw(",\"allocs\":").uint(allocs).raw('}');
+    }
+    w.raw("]}");
+#else
+    (void)reset;
+    w.raw(",\"enabled\":false}");
+#endif
+    return w.c_str();
+}
+
+// -------------- C API ----------------
+
+// Legacy entry points: the default engine, results in this thread's buffers.
+
+extern "C" const char* createGroup(const char* groupName, const char* members_str) {
+    return createGroupIn(defaultEngine, groupName, members_str);
+}
+
+extern "C" const char* createGroupPacked(const unsigned char* data, int size) {
+    return createGroupPackedIn(defaultEngine, data, size);
+}
+
+extern "C" const char* listGroups() {
+    return listGroupsIn(defaultEngine);
+}
+
+extern "C" const char* getGroupMembers(const char* groupName) {
+    return getGroupMembersIn(defaultEngine, groupName);
+}
+
+extern "C" const char* setGroupMembers(const char* groupName, const char* members_str) {
+    return setGroupMembersIn(defaultEngine, groupName, members_str);
+}
+
+extern "C" const char* setDuplicatePolicy(const char* groupName, const char* policy) {
+    return setDuplicatePolicyIn(defaultEngine, groupName, policy);
+}
+
+extern "C" const char* findDuplicates(const char* groupName) {
+    return findDuplicatesIn(defaultEngine, groupName);
+}
+
+extern "C" const char* setGroupCurrencies(const char* groupName, const char* baseCurrency, const char* rates) {
+    return setGroupCurrenciesIn(defaultEngine, groupName, baseCurrency, rates);
+}
+
+extern "C" const char* addGroupExpense(const char* groupName, const char* name, const char* category,
+                                       double amount, const char* payer, const char* members_str,
+                                       const char* shares_str, const char* date) {
+    return addGroupExpenseIn(defaultEngine, groupName, name, category, amount, payer, members_str, shares_str, date);
+}
+
+extern "C" const char* addGroupExpensePacked(const unsigned char* data, int size) {
+    return addGroupExpensePackedIn(defaultEngine, data, size);
+}
+
+extern "C" const char* loadGroupExpensesBatch(const char* groupName, const unsigned char* data, int size) {
+    return loadGroupExpensesBatchIn(defaultEngine, groupName, data, size);
+}
+
+extern "C" const char* applyGroupOps(const char* groupName, const unsigned char* data, int size) {
+    return applyGroupOpsIn(defaultEngine, groupName, data, size);
+}
+
+extern "C" const char* getGroupSyncState(const char* groupName) {
+    return getGroupSyncStateIn(defaultEngine, groupName);
+}
+
+extern "C" const char* editExpense(const char* groupName, const char* expenseId,
+                                   const char* name, const char* category, double amount,
+                                   const char* payer, const char* members_str,
+                                   const char* shares_str, const char* date) {
+    return editExpenseIn(defaultEngine, groupName, expenseId, name, category, amount, payer, members_str,
+                         shares_str, date);
+}
+
+extern "C" const char* editExpensePacked(const unsigned char* data, int size) {
+    return editExpensePackedIn(defaultEngine, data, size);
+}
+
+extern "C" const char* deleteExpense(const char* groupName, const char* expenseId) {
+    return deleteExpenseIn(defaultEngine, groupName, expenseId);
+}
+
+extern "C" const char* deleteExpensePacked(const unsigned char* data, int size) {
+    return deleteExpensePackedIn(defaultEngine, data, size);
+}
+
+extern "C" const char* showGroupExpenses(const char* groupName) {
+    return showGroupExpensesIn(defaultEngine, groupName);
+}
+
+extern "C" const char* queryGroupExpenses(const char* groupName, int offset, int limit,
+                                          const char* dateFrom, const char* dateTo,
+                                          const char* category, const char* payer) {
+    return queryGroupExpensesIn(defaultEngine, groupName, offset, limit, dateFrom, dateTo, category, payer);
+}
+
+extern "C" const char* getSpendingSummary(const char* groupName) {
+    return getSpendingSummaryIn(defaultEngine, groupName);
+}
+
+extern "C" const char* beginGroupImport(const char* groupName, const char* format) {
+    return beginGroupImportIn(defaultEngine, groupName, format);
+}
+
+extern "C" const char* feedGroupImport(const char* groupName, const unsigned char* data, int size) {
+    return feedGroupImportIn(defaultEngine, groupName, data, size);
+}
+
+extern "C" const char* finishGroupImport(const char* groupName) {
+    return finishGroupImportIn(defaultEngine, groupName);
+}
+
+extern "C" const char* exportGroupExpensesChunk(const char* groupName, const char* format, int cursor,
+                                                unsigned char* out, int capacity) {
+    return exportGroupExpensesChunkIn(defaultEngine, groupName, format, cursor, out, capacity);
+}
+
+extern "C" const unsigned char* exportGroupExpensesColumnar(const char* groupName) {
+    return exportGroupExpensesColumnarIn(defaultEngine, groupName);
+}
+
+extern "C" const unsigned char* saveSnapshot() {
+    return saveSnapshotIn(defaultEngine);
+}
+
+extern "C" const char* loadSnapshot(const unsigned char* data, int size) {
+    return loadSnapshotIn(defaultEngine, data, size);
+}
+
+extern "C" void clearAllData() {
+    clearAllDataIn(defaultEngine);
+}
+
+extern "C" const char* getGroupBalances(const char* groupName) {
+    return getGroupBalancesIn(defaultEngine, groupName);
+}
+
+extern "C" const char* calculateGroupSettlement(const char* groupName) {
+    return calculateGroupSettlementIn(defaultEngine, groupName);
+}
+
+extern "C" const char* getGroupVersion(const char* groupName) {
+    return getGroupVersionIn(defaultEngine, groupName);
+}
+
+extern "C" const char* calculateGroupSettlementWith(const char* groupName, const char* strategy,
+                                                    int timeBudgetMs) {
+    return calculateGroupSettlementWithIn(defaultEngine, groupName, strategy, timeBudgetMs);
+}
+
+extern "C" const char* calculateSettlementAsOf(const char* groupName, const char* asOfDate, const char* strategy,
+                                               int timeBudgetMs, const unsigned char* data, int size) {
+    return calculateSettlementAsOfIn(defaultEngine, groupName, asOfDate, strategy, timeBudgetMs, data, size);
+}
+
+extern "C" const char* calculateSettlementsBatch(const char* groupList, const char* strategy,
+                                                 int timeBudgetMs, int threads) {
+    return calculateSettlementsBatchIn(defaultEngine, groupList, strategy, timeBudgetMs, threads);
+}
+
+extern "C" const char* setMemoryBudget(int budgetKb, int spill) {
+    return setMemoryBudgetIn(defaultEngine, budgetKb, spill);
+}
+
+extern "C" const char* deleteGroup(const char* groupName) {
+    return deleteGroupIn(defaultEngine, groupName);
+}
+
+extern "C" const char* getEngineStats(int reset) {
+    return getEngineStatsIn(defaultEngine, reset);
+}
+
+// Handle API: any engine, every result is the caller's own malloc'd copy.
+
+static char* ownedResult(const char* json) {
+    size_t n = strlen(json) + 1;
+    char* out = (char*)malloc(n);
+    if (out) memcpy(out, json, n);
+    return out;
+}
+
+static unsigned char* ownedBinary(const unsigned char* data, int* size) {
+    if (size) *size = data ? (int)binBuffer.size() : 0;
+    if (!data) return nullptr;
+    unsigned char* out = (unsigned char*)malloc(binBuffer.size() ? binBuffer.size() : 1);
+    if (out) memcpy(out, data, binBuffer.size());
+    return out;
+}
+
+extern "C" SsEngine* ss_engine_create() {
+    return new (nothrow) SsEngine();
+}
+
+extern "C" void ss_engine_destroy(SsEngine* engine) {
+    delete engine;
+}
+
+extern "C" void ss_free(void* result) {
+    free(result);
+}
+
+extern "C" char* ss_create_group(SsEngine* engine, const char* groupName, const char* members_str) {
+    return ownedResult(createGroupIn(*engine, groupName, members_str));
+}
+
+extern "C" char* ss_create_group_packed(SsEngine* engine, const unsigned char* data, int size) {
+    return ownedResult(createGroupPackedIn(*engine, data, size));
+}
+
+extern "C" char* ss_list_groups(SsEngine* engine) {
+    return ownedResult(listGroupsIn(*engine));
+}
+
+extern "C" char* ss_get_group_members(SsEngine* engine, const char* groupName) {
+    return ownedResult(getGroupMembersIn(*engine, groupName));
+}
+
+extern "C" char* ss_set_group_members(SsEngine* engine, const char* groupName, const char* members_str) {
+    return ownedResult(setGroupMembersIn(*engine, groupName, members_str));
+}
+
+extern "C" char* ss_set_duplicate_policy(SsEngine* engine, const char* groupName, const char* policy) {
+    return ownedResult(setDuplicatePolicyIn(*engine, groupName, policy));
+}
+
+extern "C" char* ss_find_duplicates(SsEngine* engine, const char* groupName) {
+    return ownedResult(findDuplicatesIn(*engine, groupName));
+}
+
+extern "C" char* ss_set_group_currencies(SsEngine* engine, const char* groupName, const char* baseCurrency,
+                                        const char* rates) {
+    return ownedResult(setGroupCurrenciesIn(*engine, groupName, baseCurrency, rates));
+}
+
+extern "C" char* ss_add_group_expense(SsEngine* engine, const char* groupName, const char* name,
+                                      const char* category, double amount, const char* payer,
+                                      const char* members_str, const char* shares_str, const char* date) {
+    return ownedResult(addGroupExpenseIn(*engine, groupName, name, category, amount, payer, members_str,
+                                         shares_str, date));
+}
+
+extern "C" char* ss_add_group_expense_packed(SsEngine* engine, const unsigned char* data, int size) {
+    return ownedResult(addGroupExpensePackedIn(*engine, data, size));
+}
+
+extern "C" char* ss_load_group_expenses_batch(SsEngine* engine, const char* groupName,
+                                              const unsigned char* data, int size) {
+    return ownedResult(loadGroupExpensesBatchIn(*engine, groupName, data, size));
+}
+
+extern "C" char* ss_apply_group_ops(SsEngine* engine, const char* groupName, const unsigned char* data, int size) {
+    return ownedResult(applyGroupOpsIn(*engine, groupName, data, size));
+}
+
+extern "C" char* ss_get_group_sync_state(SsEngine* engine, const char* groupName) {
+    return ownedResult(getGroupSyncStateIn(*engine, groupName));
+}
+
+extern "C" char* ss_edit_expense(SsEngine* engine, const char* groupName, const char* expenseId,
+                                 const char* name, const char* category, double amount,
+                                 const char* payer, const char* members_str,
+                                 const char* shares_str, const char* date) {
+    return ownedResult(editExpenseIn(*engine, groupName, expenseId, name, category, amount, payer,
+                                     members_str, shares_str, date));
+}
+
+extern "C" char* ss_edit_expense_packed(SsEngine* engine, const unsigned char* data, int size) {
+    return ownedResult(editExpensePackedIn(*engine, data, size));
+}
+
+extern "C" char* ss_delete_expense(SsEngine* engine, const char* groupName, const char* expenseId) {
+    return ownedResult(deleteExpenseIn(*engine, groupName, expenseId));
+}
+
+extern "C" char* ss_delete_expense_packed(SsEngine* engine, const unsigned char* data, int size) {
+    return ownedResult(deleteExpensePackedIn(*engine, data, size));
+}
+
+extern "C" char* ss_show_group_expenses(SsEngine* engine, const char* groupName) {
+    return ownedResult(showGroupExpensesIn(*engine, groupName));
+}
+
+extern "C" char* ss_query_group_expenses(SsEngine* engine, const char* groupName, int offset, int limit,
+                                         const char* dateFrom, const char* dateTo,
+                                         const char* category, const char* payer) {
+    return ownedResult(queryGroupExpensesIn(*engine, groupName, offset, limit, dateFrom, dateTo, category, payer));
+}
+
+extern "C" char* ss_get_spending_summary(SsEngine* engine, const char* groupName) {
+    return ownedResult(getSpendingSummaryIn(*engine, groupName));
+}
+
+extern "C" char* ss_begin_group_import(SsEngine* engine, const char* groupName, const char* format) {
+    return ownedResult(beginGroupImportIn(*engine, groupName, format));
+}
+
+extern "C" char* ss_feed_group_import(SsEngine* engine, const char* groupName, const unsigned char* data, int size) {
+    return ownedResult(feedGroupImportIn(*engine, groupName, data, size));
+}
+
+extern "C" char* ss_finish_group_import(SsEngine* engine, const char* groupName) {
+    return ownedResult(finishGroupImportIn(*engine, groupName));
+}
+
+extern "C" char* ss_export_group_expenses_chunk(SsEngine* engine, const char* groupName, const char* format,
+                                                int cursor, unsigned char* out, int capacity) {
+    return ownedResult(exportGroupExpensesChunkIn(*engine, groupName, format, cursor, out, capacity));
+}
+
+extern "C" unsigned char* ss_export_group_expenses_columnar(SsEngine* engine, const char* groupName, int* size) {
+    return ownedBinary(exportGroupExpensesColumnarIn(*engine, groupName), size);
+}
+
+extern "C" unsigned char* ss_save_snapshot(SsEngine* engine, int* size) {
+    return ownedBinary(saveSnapshotIn(*engine), size);
+}
+
+extern "C" char* ss_load_snapshot(SsEngine* engine, const unsigned char* data, int size) {
+    return ownedResult(loadSnapshotIn(*engine, data, size));
+}
+
+extern "C" void ss_clear_all_data(SsEngine* engine) {
+    clearAllDataIn(*engine);
+}
+
+extern "C" char* ss_get_group_balances(SsEngine* engine, const char* groupName) {
+    return ownedResult(getGroupBalancesIn(*engine, groupName));
+}
+
+extern "C" char* ss_calculate_group_settlement(SsEngine* engine, const char* groupName) {
+    return ownedResult(calculateGroupSettlementIn(*engine, groupName));
+}
+
+extern "C" char* ss_get_group_version(SsEngine* engine, const char* groupName) {
+    return ownedResult(getGroupVersionIn(*engine, groupName));
+}
+
+extern "C" char* ss_calculate_group_settlement_with(SsEngine* engine, const char* groupName,
+                                                    const char* strategy, int timeBudgetMs) {
+    return ownedResult(calculateGroupSettlementWithIn(*engine, groupName, strategy, timeBudgetMs));
+}
+
+extern "C" char* ss_calculate_settlement_as_of(SsEngine* engine, const char* groupName, const char* asOfDate,
+                                              const char* strategy, int timeBudgetMs,
+                                              const unsigned char* data, int size) {
+    return ownedResult(calculateSettlementAsOfIn(*engine, groupName, asOfDate, strategy, timeBudgetMs, data, size));
+}
+
+extern "C" char* ss_calculate_settlements_batch(SsEngine* engine, const char* groupList, const char* strategy,
+                                                int timeBudgetMs, int threads) {
+    return ownedResult(calculateSettlementsBatchIn(*engine, groupList, strategy, timeBudgetMs, threads));
+}
+
+extern "C" char* ss_get_engine_stats(SsEngine* engine, int reset) {
+    return ownedResult(getEngineStatsIn(*engine, reset));
+}
+
+extern "C" char* ss_set_memory_budget(SsEngine* engine, int budgetKb, int spill) {
+    return ownedResult(setMemoryBudgetIn(*engine, budgetKb, spill));
+}
+
+extern "C" char* ss_delete_group(SsEngine* engine, const char* groupName) {
+    return ownedResult(deleteGroupIn(*engine, groupName));
 }
@@ -1,24 +1,200 @@
 #ifndef EXPENSE_H
 #define EXPENSE_H
 
+#include <cstdint>
+#include <map>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+// Money is held in minor units (paise/cents) so sums are exact.
+typedef int64_t Money;
+
+// Build profile: names a group indexes inline before it switches to a hash map. Sized
+// for the usual 2-8 person group. Only the name index is affected: it saves the map's
+// memory and the allocations that build it, not per-call time.
+#ifndef SPENDSENSE_INLINE_NAMES
+#define SPENDSENSE_INLINE_NAMES 8
+#endif
+
 struct Expense {
-    std::string id;
+    uint32_t id = 0;
+    bool live = true;               // false once deleted; the slot is reclaimed by compaction
+    uint16_t currency = 0;          // index into Group::currencies; 0 = the base currency
     std::string name;
     std::string category;
-    double amount;
-    std::string payer;
-    std::vector<std::string> members;
-    std::vector<double> shares;
+    Money amount = 0;               // in the group's base currency, as are the shares
+    Money original = 0;             // amount as entered, in currency; only set when currency != 0
+    uint32_t payer = 0;             // index into Group::names
+    bool equalSplit = false;        // shares are amount / shareCount, remainder to the first members
+    uint32_t shareBegin = 0;        // first row in Group::equalMember if equalSplit, else in shareMember/shareAmount
+    uint32_t shareCount = 0;        // members in the split, one row each
     std::string date;
 };
 
+// Rollup buckets; count tracks contributing rows so empty buckets can be dropped.
+struct CategoryTotal {
+    Money total = 0;
+    int64_t count = 0;
+};
+
+struct MemberSpend {
+    Money paid = 0;   // amounts this member paid
+    Money share = 0;  // this member's shares of expenses
+    int64_t count = 0;
+};
+
+// An entry of a group's currency table. rate is base-currency minor units per minor
+// unit of code, scaled by 10^6 (1 USD = 83.25 INR is 83250000 in an INR group).
+struct Currency {
+    std::string code;
+    int64_t rate;
+};
+
+struct Transfer {
+    uint32_t from, to; // name ids
+    Money amount;
+};
+
+// The last settlement computed for a group, reused while Group::version stays put.
+struct SettlementCache {
+    uint64_t version = 0;           // Group::version it was computed at; 0 = empty
+    std::string strategy;           // as requested, empty for calculateGroupSettlement
+    int timeBudgetMs = 0;           // only "exact" depends on it; 0 for the others
+    std::vector<Transfer> transfers;
+    std::string json;
+};
+
+// Cumulative ledgers along Group::byDate for calculateSettlementAsOf. Row k holds every
+// name's balance over the first (k + 1) * stride distinct dates, the last of which is
+// dates[k]. A write on some date drops only the rows ending on or after it, and the next
+// query extends the table from the last row left, so date-ordered adds cost a replay of
+// the new tail. stride doubles, keeping every other row, when the table outgrows its
+// budget.
+struct LedgerCheckpoints {
+    size_t stride = 1;
+    size_t width = 0;               // names per row
+    std::vector<std::string> dates; // last date each row covers, ascending
+    std::vector<Money> rows;
+};
+
+// Name -> id index over Group::names, where an id is the name's position. While a
+// group has at most SPENDSENSE_INLINE_NAMES names (roster plus outside payers, which
+// covers most groups) it keeps a one-byte hash tag per name inline and confirms a
+// tag hit against names, so the index itself holds no heap memory; lookups cost about
+// what the map's do. The first name past that moves the whole index into a hash map.
+// This is the only storage that differs by group size; Group has one layout for all.
+class NameIndex {
+public:
+    static const uint32_t npos = UINT32_MAX;
+
+    // Id of key in names, or npos.
+    uint32_t find(const std::vector<std::string> &names, std::string_view key) const;
+    // Indexes names[id], which must be the next id: names.size() - 1 after an append,
+    // or each id in turn when rebuilding.
+    void add(const std::vector<std::string> &names, uint32_t id);
+    size_t size() const { return count; }
+    bool isInline() const { return count <= SPENDSENSE_INLINE_NAMES; }
+    size_t heapBytes() const;
+
+private:
+    static_assert(SPENDSENSE_INLINE_NAMES > 0, "SPENDSENSE_INLINE_NAMES must be positive");
+    uint32_t count = 0;
+    uint8_t tags[SPENDSENSE_INLINE_NAMES] = {};
+    std::unordered_map<std::string, uint32_t> map; // empty while inline
+};
+
+// What ingest does with an expense matching a live one; see setDuplicatePolicy.
+enum DupPolicy : uint8_t { DUP_OFF, DUP_FLAG, DUP_REJECT };
+
+// std::mutex that keeps Group movable: copies and moves get a fresh, unlocked mutex.
+struct GroupLock {
+    std::mutex m;
+    GroupLock() = default;
+    GroupLock(const GroupLock &) {}
+    GroupLock &operator=(const GroupLock &) { return *this; }
+};
+
+// A streaming import in progress on a group (beginGroupImport .. finishGroupImport).
+// pending holds the start of a record cut off at a chunk boundary; quoted carries the
+// CSV quote state at its end, so each byte is scanned once however the input is cut.
+struct GroupImport {
+    bool active = false;
+    bool csv = false;               // else NDJSON
+    bool skipping = false;          // dropping the rest of an over-long record
+    bool quoted = false;
+    std::string pending;
+    std::vector<int> columns;       // CSV: field index per known column, -1 if absent; empty until the header
+    uint64_t line = 0;              // input lines consumed
+    uint64_t added = 0, warnings = 0, rejected = 0;
+};
+
 struct Group {
     std::string name;
+    mutable GroupLock lock;         // held for the duration of any call on this group
+    uint64_t lastUse = 0;           // engine use clock at the last call, for LRU eviction
+    size_t accountedBytes = 0;      // this group's share of the engine's budgeted bytes
     std::vector<std::string> members;
-    std::vector<Expense> expenses;
+    uint32_t nextId = 1;            // id handed to the next added expense
+    std::vector<Expense> expenses;  // insertion order, may contain deleted tombstones
+    std::vector<int32_t> slotById;  // expense id -> index into expenses, -1 when deleted
+    size_t tombstones = 0;
+
+    // Split rows of every custom-share expense as struct-of-arrays, so balance kernels
+    // stream two flat columns: row k charges shareAmount[k] to name id shareMember[k].
+    // Even splits, the common case, store only their members in equalMember and derive
+    // each share from the amount. Rows of deleted or replaced expenses are zeroed in place
+    // (custom rows) and dropped when the group compacts; deadShareRows counts both kinds.
+    std::vector<uint32_t> shareMember;
+    std::vector<Money> shareAmount;
+    std::vector<uint32_t> equalMember;
+    size_t deadShareRows = 0;
+
+    // Intern table for every name an expense can reference. Ids below rosterSize are
+    // the distinct roster members in order; later ids are payers from outside it.
+    std::vector<std::string> names;
+    NameIndex nameIndex;
+    uint32_t rosterSize = 0;
+
+    // Running balance per name id, updated by delta whenever an expense is added,
+    // edited or removed.
+    std::vector<Money> ledger;
+    std::vector<Money> paid; // total paid per name id; the member's share is paid - ledger
+
+    // Currency table, empty for a single-currency group. currencies[0] is the base the
+    // ledger is kept in; an expense in another currency is converted once on ingest at
+    // its entry's rate, so balances and settlement never look a rate up.
+    std::vector<Currency> currencies;
+
+    // Secondary indexes over live expenses for queryGroupExpenses. Every posting
+    // list holds expense ids in ascending order; empty lists are dropped.
+    std::map<std::string, std::vector<uint32_t>, std::less<>> byDate; // transparent: probe with string_view
+    std::unordered_map<std::string, std::vector<uint32_t>> byCategory;
+    std::vector<std::vector<uint32_t>> byPayer; // indexed by name id
+
+    // Spending rollups keyed by month ("YYYY-MM", the date's first 7 characters).
+    std::map<std::pair<std::string, std::string>, CategoryTotal> categoryByMonth; // (month, category)
+    std::map<std::pair<std::string, uint32_t>, MemberSpend> memberByMonth;        // (month, name id)
+
+    // Delta sync from Firestore: document id -> Expense::id for expenses that arrived
+    // through applyGroupOps.
+    std::unordered_map<std::string, uint32_t> idByDoc;
+
+    // Duplicate detection. Unless the policy is DUP_OFF, every live expense is indexed
+    // here by its fingerprint (payer, amount, date, members, name), so ingest finds a
+    // match in O(1).
+    DupPolicy dupPolicy = DUP_OFF;
+    std::unordered_multimap<uint64_t, uint32_t> dupIndex;
+
+    GroupImport import; // not part of snapshots; a group mid-import is never evicted
+
+    // Bumped on every ledger change. Each new or reloaded group starts from a fresh
+    // engine-wide epoch in the high 32 bits, so a version is never handed out twice.
+    uint64_t version = 0;
+    SettlementCache settled;
+    LedgerCheckpoints checkpoints;
 };
 
 #ifdef __cplusplus
@@ -26,18 +202,213 @@ extern "C" {
 #endif
 
 const char* createGroup(const char* groupName, const char* members_str);
+// Length-prefixed variants of createGroup, addGroupExpense, editExpense and
+// deleteExpense: one buffer of u32-length-prefixed UTF-8 strings instead of C strings,
+// laid out as described under "Packed Arguments" in expense.cpp. Shares are f64
+// amounts as in loadGroupExpensesBatch. A buffer that does not parse exactly is
+// rejected with {"error":"Malformed arguments"}.
+const char* createGroupPacked(const unsigned char* data, int size);
+const char* addGroupExpensePacked(const unsigned char* data, int size);
+const char* editExpensePacked(const unsigned char* data, int size);
+const char* deleteExpensePacked(const unsigned char* data, int size);
 const char* listGroups();
 const char* getGroupMembers(const char* groupName);
+// Adds the names in members_str that are not on the roster yet, in order. The roster
+// only grows: existing members stay, as their expenses still refer to them. A name
+// that so far only appeared as an outside payer keeps its expenses and becomes a
+// member. Returns {"ok":true,"added":n,"members":rosterSize}.
+const char* setGroupMembers(const char* groupName, const char* members_str);
+// Duplicate handling on ingest, policy "off" (default), "flag" or "reject": an expense
+// with the same payer, amount, currency, date, name and set of members as a live one
+// is added with "duplicateOf":"id" in the addGroupExpense result, or rejected with
+// "Duplicate expense" (batch, import and op-log rows are rejected individually). Edits
+// are not checked. Returns {"ok":true,"policy":...}.
+const char* setDuplicatePolicy(const char* groupName, const char* policy);
+// {"group":...,"duplicates":[["id","id",...],...]}: each set of live expenses that are
+// duplicates of each other, by first id, whatever the policy. Costs a hash per expense
+// (none while a policy is on) and a sort, not a pairwise scan.
+const char* findDuplicates(const char* groupName);
+// Sets the group's base currency and conversion rates, rates being "CODE:rate" entries
+// separated by '|', where rate is units of base per unit of CODE (up to 6 decimals),
+// e.g. setGroupCurrencies(g, "INR", "USD:83.25|EUR:90.1"). Listed codes are added or
+// re-rated; others stay. Expenses name their currency in the batch record (empty =
+// base; the text-argument calls always use the base) and are converted to the base on
+// entry, so an existing expense keeps its rate until edited. The base cannot change
+// while the group has expenses. Returns {"ok":true,"base":...,"currencies":n}.
+const char* setGroupCurrencies(const char* groupName, const char* baseCurrency, const char* rates);
 const char* addGroupExpense(const char* groupName, const char* name, const char* category,
                             double amount, const char* payer, const char* members_str,
                             const char* shares_str, const char* date);
+// Ingests many expenses in one call; see BatchReader in expense.cpp for the packed layout.
+const char* loadGroupExpensesBatch(const char* groupName, const unsigned char* data, int size);
+// Applies Firestore document changes as an op log; see readOp in expense.cpp for the
+// layout. added/modified upsert by document id and removed drops it, so re-sending a
+// document's current state is harmless.
+const char* applyGroupOps(const char* groupName, const unsigned char* data, int size);
+// {"docs":n}: documents mapped by applyGroupOps, so a client restored from a snapshot
+// can tell whether it still needs a full sync.
+const char* getGroupSyncState(const char* groupName);
 const char* editExpense(const char* groupName, const char* expenseId,
                         const char* name, const char* category, double amount,
                         const char* payer, const char* members_str,
                         const char* shares_str, const char* date);
 const char* deleteExpense(const char* groupName, const char* expenseId);
 const char* showGroupExpenses(const char* groupName);
+// One page of a group's expenses, ordered by date then id. Empty filter strings match
+// everything; dateFrom/dateTo are inclusive and compare as text (YYYY-MM-DD).
+// limit < 0 means no limit. The response carries "total" matches before paging.
+const char* queryGroupExpenses(const char* groupName, int offset, int limit,
+                               const char* dateFrom, const char* dateTo,
+                               const char* category, const char* payer);
+// Maintained rollups: spend per category per month and paid/share per member per month.
+const char* getSpendingSummary(const char* groupName);
+// Streaming import of CSV or NDJSON (format "csv" / "ndjson") in chunks of any size,
+// cut anywhere, so a large statement never has to be resident at once. A CSV file
+// starts with a header naming its columns, any of id, name, category, amount, payer,
+// members, shares, date, currency in any order (amount, payer and members are required);
+// members and shares are pipe-separated. An NDJSON line is an object with the same
+// keys, where members and shares may also be arrays. Rows are validated like
+// addGroupExpense; a bad row is rejected by line number and the import continues.
+// beginGroupImport replaces any import already in progress on the group. Each
+// feedGroupImport returns the rows it added, warned on and rejected;
+// finishGroupImport consumes a last line without a newline and reports the totals.
+const char* beginGroupImport(const char* groupName, const char* format);
+const char* feedGroupImport(const char* groupName, const unsigned char* data, int size);
+const char* finishGroupImport(const char* groupName);
+// Chunked export in the same formats, in id order, written into out (capacity bytes)
+// as whole rows only. Start with cursor 0 (a CSV export begins with its header) and
+// pass back the returned cursor until "done"; the cursor is an expense id, so edits and
+// deletes between chunks are safe. Returns {"ok":true,"written":n,"cursor":c,"done":b},
+// or "Buffer too small" with "needed" bytes if not even one row fits.
+const char* exportGroupExpensesChunk(const char* groupName, const char* format, int cursor,
+                                     unsigned char* out, int capacity);
+// Columnar alternative to showGroupExpenses, laid out for typed-array views over HEAPU8.
+// Returns NULL if the group is missing; the buffer stays valid until the next binary export.
+const unsigned char* exportGroupExpensesColumnar(const char* groupName);
+int getLastBinarySize();
+// Whole-engine snapshot in the binary export buffer (size from getLastBinarySize).
+// loadSnapshot replaces every group, or changes nothing if the blob is rejected.
+// Only expenses and settings are stored: ledger, splits, indexes and rollups are
+// rebuilt on load, so loading is one O(expenses) pass rather than a copy.
+const unsigned char* saveSnapshot();
+const char* loadSnapshot(const unsigned char* data, int size);
+void clearAllData();
+// Per name: total paid, total share and balance (paid - share), roster members first,
+// in the base currency (named by "currency" once setGroupCurrencies has been called).
+const char* getGroupBalances(const char* groupName);
+// Settlements are cached per group until its next change, so repeating a call on an
+// unchanged group returns a copy of the same JSON without recomputing it.
 const char* calculateGroupSettlement(const char* groupName);
+// {"group":...,"version":"n"}: changes whenever the group's balances may have, so the
+// UI can skip the settlement call and its re-render while it reads the same. Compare as
+// a string; it does not fit a JS number exactly.
+const char* getGroupVersion(const char* groupName);
+// strategy is "greedy" (name order, same as calculateGroupSettlement), "heap" (largest
+// debtor against largest creditor) or "exact" (fewest transfers, up to 20 open balances
+// after pairing off exact opposites). "exact" falls back to "heap" when it cannot finish
+// within timeBudgetMs (<= 0 means no limit); the "strategy" field reports what ran.
+const char* calculateGroupSettlementWith(const char* groupName, const char* strategy,
+                                         int timeBudgetMs);
+// Read-only settlement as of a date and/or with hypothetical expenses: only expenses
+// dated on or before asOfDate count (empty = all), plus the what-if expenses in data,
+// in the loadGroupExpensesBatch layout (size 0 for none; they obey the same cutoff).
+// The group itself is not changed. Balances come from a table of cumulative balances at
+// every stride-th date: a binary search, a copy of one row and a replay of fewer than
+// stride dates. The table is kept across writes; a write drops only the rows from its
+// date on, so the next call replays the expenses dated from there (just the new ones
+// for adds in date order). The first call on a group builds the table in one pass.
+// strategy and timeBudgetMs are as for calculateGroupSettlementWith.
+// Returns a calculateGroupSettlementWith result with "asOf" and
+// "hypothetical" (count) added, or an error with the "index" of a bad what-if row.
+const char* calculateSettlementAsOf(const char* groupName, const char* asOfDate, const char* strategy,
+                                    int timeBudgetMs, const unsigned char* data, int size);
+// Settles many groups at once on a work-stealing pool. groupList is pipe-separated
+// names or "*" for every group (in name order); strategy and timeBudgetMs (per group)
+// are as above. threads <= 0 uses every core; a WASM build without -pthread runs
+// serially. Returns {"strategy":...,"groups":[...]} with one calculateGroupSettlementWith
+// result per group, in list order, or {"group":...,"error":...} for a missing one.
+const char* calculateSettlementsBatch(const char* groupList, const char* strategy,
+                                      int timeBudgetMs, int threads);
+// Telemetry: {"groups":[{"group","expenses","bytes"}],"totalExpenses","totalBytes",
+// "enabled",...} with an estimated heap footprint per group. Builds with
+// -DSPENDSENSE_STATS add "calls": per export, the call count, totalNs, approximate
+// p50Ns/p99Ns, resultBytes serialized and heap allocations on the calling thread.
+// reset != 0 zeroes the call counters after reading them.
+const char* getEngineStats(int reset);
+// Bounds the engine's heap: once groups use more than budgetKb (estimated; 0 = no
+// limit), the least recently used ones are evicted until usage is back under 7/8 of
+// it. With spill != 0 an evicted group is kept as a compact snapshot blob and comes
+// back transparently on its next access by name (listGroups, saveSnapshot and "*"
+// batches include it); otherwise it is dropped and reads as "Group not found", so
+// the caller re-syncs it. Returns {"ok":true,"evicted":n}.
+const char* setMemoryBudget(int budgetKb, int spill);
+// Removes a group, live or spilled.
+const char* deleteGroup(const char* groupName);
+
+// Handle-based API. Engines are independent of each other and of the functions above,
+// which act on a built-in default engine and return a per-thread buffer that the next
+// call on the same thread overwrites. An engine may be shared between threads: calls
+// on one group are serialized, calls on different groups run concurrently. Every
+// result here is a malloc'd copy owned by the caller (release with ss_free); binary
+// results also report their byte size through *size and are NULL on a missing group.
+typedef struct SsEngine SsEngine;
+
+SsEngine* ss_engine_create(void);
+void ss_engine_destroy(SsEngine* engine);
+void ss_free(void* result);
+
+char* ss_create_group(SsEngine* engine, const char* groupName, const char* members_str);
+char* ss_create_group_packed(SsEngine* engine, const unsigned char* data, int size);
+char* ss_list_groups(SsEngine* engine);
+char* ss_get_group_members(SsEngine* engine, const char* groupName);
+char* ss_set_group_members(SsEngine* engine, const char* groupName, const char* members_str);
+char* ss_set_duplicate_policy(SsEngine* engine, const char* groupName, const char* policy);
+char* ss_find_duplicates(SsEngine* engine, const char* groupName);
+char* ss_set_group_currencies(SsEngine* engine, const char* groupName, const char* baseCurrency,
+                              const char* rates);
+char* ss_add_group_expense(SsEngine* engine, const char* groupName, const char* name,
+                           const char* category, double amount, const char* payer,
+                           const char* members_str, const char* shares_str, const char* date);
+char* ss_add_group_expense_packed(SsEngine* engine, const unsigned char* data, int size);
+char* ss_load_group_expenses_batch(SsEngine* engine, const char* groupName,
+                                   const unsigned char* data, int size);
+char* ss_apply_group_ops(SsEngine* engine, const char* groupName, const unsigned char* data, int size);
+char* ss_get_group_sync_state(SsEngine* engine, const char* groupName);
+char* ss_edit_expense(SsEngine* engine, const char* groupName, const char* expenseId,
+                      const char* name, const char* category, double amount,
+                      const char* payer, const char* members_str,
+                      const char* shares_str, const char* date);
+char* ss_edit_expense_packed(SsEngine* engine, const unsigned char* data, int size);
+char* ss_delete_expense(SsEngine* engine, const char* groupName, const char* expenseId);
+char* ss_delete_expense_packed(SsEngine* engine, const unsigned char* data, int size);
+char* ss_show_group_expenses(SsEngine* engine, const char* groupName);
+char* ss_query_group_expenses(SsEngine* engine, const char* groupName, int offset, int limit,
+                              const char* dateFrom, const char* dateTo,
+                              const char* category, const char* payer);
+char* ss_get_spending_summary(SsEngine* engine, const char* groupName);
+char* ss_begin_group_import(SsEngine* engine, const char* groupName, const char* format);
+char* ss_feed_group_import(SsEngine* engine, const char* groupName, const unsigned char* data, int size);
+char* ss_finish_group_import(SsEngine* engine, const char* groupName);
+char* ss_export_group_expenses_chunk(SsEngine* engine, const char* groupName, const char* format,
+                                     int cursor, unsigned char* out, int capacity);
+unsigned char* ss_export_group_expenses_columnar(SsEngine* engine, const char* groupName, int* size);
+unsigned char* ss_save_snapshot(SsEngine* engine, int* size);
+char* ss_load_snapshot(SsEngine* engine, const unsigned char* data, int size);
+void ss_clear_all_data(SsEngine* engine);
+char* ss_get_group_balances(SsEngine* engine, const char* groupName);
+char* ss_calculate_group_settlement(SsEngine* engine, const char* groupName);
+char* ss_get_group_version(SsEngine* engine, const char* groupName);
+char* ss_calculate_group_settlement_with(SsEngine* engine, const char* groupName,
+                                         const char* strategy, int timeBudgetMs);
+char* ss_calculate_settlement_as_of(SsEngine* engine, const char* groupName, const char* asOfDate,
+                                    const char* strategy, int timeBudgetMs,
+                                    const unsigned char* data, int size);
+char* ss_calculate_settlements_batch(SsEngine* engine, const char* groupList, const char* strategy,
+                                     int timeBudgetMs, int threads);
+// Group footprints are this engine's; call counters are shared by every engine.
+char* ss_get_engine_stats(SsEngine* engine, int reset);
+char* ss_set_memory_budget(SsEngine* engine, int budgetKb, int spill);
+char* ss_delete_group(SsEngine* engine, const char* groupName);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,340 @@
+// Benchmark harness for the expense engine on synthetic groups.
+//
+// Native: g++ -O2 -std=c++17 -pthread expense.cpp expense_bench.cpp -o expense_bench
+// WASM:   emcc -O2 -std=c++17 expense.cpp expense_bench.cpp -sALLOW_MEMORY_GROWTH
+//              -sENVIRONMENT=node -o expense_bench.js && node expense_bench.js
+//         (add -pthread -sPTHREAD_POOL_SIZE=8 for a threaded batch settlement)
+//
+// Usage: expense_bench [--full] [filter]
+//   By default runs up to 10k expenses; --full adds the 100k and 1M expense and
+//   10k member cases. filter keeps only scenarios whose label contains it. The m=4
+//   groups stay within SPENDSENSE_INLINE_NAMES and use the inline name index, m=10
+//   and up use the hash map; rebuild with -DSPENDSENSE_INLINE_NAMES=1 to run m=4 on
+//   the map. The per-call lines match either way; the difference is the map's memory
+//   (the "bytes" of getEngineStats) and its one-off build. The "batch" scenarios
+//   settle many small groups in one calculateSettlementsBatch call.
+//   "startup" runs first: time to main (for WASM, loading and instantiating the module;
+//   build with the size-optimized flags in expense-worker.js to track that build) and
+//   the first call of each kind on a cold engine.
+//
+// Each line reports ns/op, heap allocations/op and peak RSS (native) or linear
+// memory size (WASM) after the scenario.
+
+#include "expense.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ctime>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// Counted from every thread, batch settlement workers included.
+static atomic<size_t> allocCount{0};
+
+void* operator new(size_t n) {
+    allocCount.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static double peakMemoryMb() {
+#ifdef __EMSCRIPTEN__
+    return __builtin_wasm_memory_size(0) * 65536.0 / (1024 * 1024);
+#else
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0; // ru_maxrss is in KiB on Linux
+#endif
+}
+
+typedef chrono::steady_clock Clock;
+
+struct Measure {
+    Clock::time_point start = Clock::now();
+    size_t allocs = allocCount.load(memory_order_relaxed);
+    Clock::duration excluded{};
+    size_t excludedAllocs = 0;
+
+    // Runs f outside the measurement, e.g. a write that invalidates the settlement cache.
+    template <typename F>
+    void untimed(F f) {
+        Clock::time_point t = Clock::now();
+        size_t a = allocCount.load(memory_order_relaxed);
+        f();
+        excludedAllocs += allocCount.load(memory_order_relaxed) - a;
+        excluded += Clock::now() - t;
+    }
+
+    void report(const string &label, const char* op, size_t ops) const {
+        double ns = chrono::duration<double, nano>(Clock::now() - start - excluded).count();
+        size_t n = allocCount.load(memory_order_relaxed) - allocs - excludedAllocs;
+        printf("%-34s %-26s %12.1f ns/op %9.2f allocs/op %9.1f MB peak\n", label.c_str(), op,
+               ns / (double)ops, (double)n / (double)ops, peakMemoryMb());
+    }
+};
+
+struct Scenario {
+    int members;
+    int expenses;
+    bool customShares;
+};
+
+// Pre-rendered C API arguments, so argument building stays outside the timings.
+struct ExpenseArgs {
+    string payer, members, shares;
+    double amount;
+};
+
+static string scenarioLabel(const Scenario &s) {
+    char label[64];
+    snprintf(label, sizeof label, "m=%d e=%d %s", s.members, s.expenses, s.customShares ? "custom" : "equal");
+    return label;
+}
+
+static const int PARTICIPANTS = 6; // members per expense, capped by the group size
+
+static vector<ExpenseArgs> makeExpenses(const Scenario &s, mt19937 &rng) {
+    vector<ExpenseArgs> out(s.expenses);
+    int per = s.members < PARTICIPANTS ? s.members : PARTICIPANTS;
+    char buf[32];
+    for (auto &a : out) {
+        long cents = 100 + rng() % 500000;
+        a.amount = cents / 100.0;
+        a.payer = "m" + to_string(rng() % s.members);
+        int first = rng() % s.members;
+        long left = cents;
+        for (int i = 0; i < per; ++i) {
+            a.members += "m" + to_string((first + i) % s.members) + "|";
+            if (s.customShares) {
+                long share = i == per - 1 ? left : left / (per - i);
+                left -= share;
+                snprintf(buf, sizeof buf, "%ld.%02ld|", share / 100, share % 100);
+                a.shares += buf;
+            }
+        }
+    }
+    return out;
+}
+
+static void run(const Scenario &s) {
+    string label = scenarioLabel(s);
+    string group = "bench " + label;
+
+    clearAllData(); // keep earlier scenarios out of the snapshot timings
+    mt19937 rng(42);
+    string roster;
+    for (int i = 0; i < s.members; ++i) roster += "m" + to_string(i) + "|";
+    createGroup(group.c_str(), roster.c_str());
+    vector<ExpenseArgs> args = makeExpenses(s, rng);
+
+    {
+        Measure m;
+        for (auto &a : args)
+            addGroupExpense(group.c_str(), "Bench expense", "Food", a.amount, a.payer.c_str(),
+                            a.members.c_str(), a.shares.c_str(), "2025-01-15");
+        m.report(label, "addGroupExpense", args.size());
+    }
+
+    const size_t edits = args.size() < 10000 ? args.size() : 10000;
+    vector<string> ids(edits);
+    for (auto &id : ids) id = to_string(1 + rng() % s.expenses);
+    {
+        Measure m;
+        for (size_t i = 0; i < edits; ++i) {
+            const ExpenseArgs &a = args[(i * 7919) % args.size()];
+            editExpense(group.c_str(), ids[i].c_str(), "Edited", "Travel", a.amount, a.payer.c_str(),
+                        a.members.c_str(), a.shares.c_str(), "2025-02-01");
+        }
+        m.report(label, "editExpense", edits);
+    }
+
+    const int reps = s.expenses >= 100000 ? 3 : 20;
+    {
+        Measure m;
+        for (int i = 0; i < reps; ++i) showGroupExpenses(group.c_str());
+        m.report(label, "showGroupExpenses", reps);
+    }
+    {
+        // Re-saving expense 1 unchanged bumps the group version, so every call recomputes.
+        const ExpenseArgs &a = args[0];
+        Measure m;
+        for (int i = 0; i < reps * 10; ++i) {
+            m.untimed([&] {
+                editExpense(group.c_str(), "1", "Bench expense", "Food", a.amount, a.payer.c_str(),
+                            a.members.c_str(), a.shares.c_str(), "2025-01-15");
+            });
+            calculateGroupSettlement(group.c_str());
+        }
+        m.report(label, "calculateGroupSettlement", reps * 10);
+    }
+    {
+        Measure m;
+        for (int i = 0; i < reps * 10; ++i) calculateGroupSettlement(group.c_str());
+        m.report(label, "settlement cache hit", reps * 10);
+    }
+
+    {
+        Measure m;
+        for (int i = 0; i < reps; ++i) saveSnapshot();
+        m.report(label, "saveSnapshot", reps);
+    }
+    {
+        const unsigned char* p = saveSnapshot();
+        vector<unsigned char> snapshot(p, p + getLastBinarySize());
+        Measure m;
+        for (int i = 0; i < reps; ++i) loadSnapshot(snapshot.data(), (int)snapshot.size());
+        m.report(label, "loadSnapshot", reps);
+    }
+
+    // Delete a tenth of the group, in random order, last so the other timings see a full group.
+    const size_t deletes = args.size() / 10 ? args.size() / 10 : 1;
+    vector<string> victims;
+    victims.reserve(deletes);
+    for (size_t i = 1; i <= args.size(); ++i) victims.push_back(to_string(i));
+    shuffle(victims.begin(), victims.end(), rng);
+    victims.resize(deletes);
+    {
+        Measure m;
+        for (auto &id : victims) deleteExpense(group.c_str(), id.c_str());
+        m.report(label, "deleteExpense", deletes);
+    }
+}
+
+// Time from process start to main: for WASM, performance.now() at entry, i.e. fetching,
+// compiling and instantiating the module; natively the CPU time spent loading and in
+// static initializers.
+static double startupNs() {
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_now() * 1e6;
+#else
+    return (double)clock() * 1e9 / CLOCKS_PER_SEC;
+#endif
+}
+
+// First calls on a cold engine, which also pay for lazily built state (per-thread
+// buffers, the group pool). Runs before any other scenario has warmed the engine.
+static void runStartup(double mainNs) {
+    const string label = "startup";
+    printf("%-34s %-26s %12.1f ns/op\n", label.c_str(), "process start to main", mainNs);
+    {
+        Measure m;
+        createGroup("startup", "a|b|c");
+        m.report(label, "cold createGroup", 1);
+    }
+    {
+        Measure m;
+        addGroupExpense("startup", "Bench expense", "Food", 30, "a", "a|b|c", "", "2025-01-15");
+        m.report(label, "cold addGroupExpense", 1);
+    }
+    {
+        Measure m;
+        showGroupExpenses("startup");
+        m.report(label, "cold showGroupExpenses", 1);
+    }
+    {
+        Measure m;
+        calculateGroupSettlement("startup");
+        m.report(label, "cold settlement", 1);
+    }
+    clearAllData();
+}
+
+// Month-end job: many small groups settled in one call, serially and on every core.
+static void runBatch(int groupCount) {
+    clearAllData();
+    mt19937 rng(7);
+    Scenario s{8, 20, false};
+    char label[64];
+    snprintf(label, sizeof label, "batch g=%d e=%d", groupCount, s.expenses);
+    string roster;
+    for (int i = 0; i < s.members; ++i) roster += "m" + to_string(i) + "|";
+    vector<ExpenseArgs> first(groupCount);
+    for (int g = 0; g < groupCount; ++g) {
+        string name = "batch " + to_string(g);
+        createGroup(name.c_str(), roster.c_str());
+        vector<ExpenseArgs> args = makeExpenses(s, rng);
+        for (auto &a : args)
+            addGroupExpense(name.c_str(), "Bench expense", "Food", a.amount, a.payer.c_str(),
+                            a.members.c_str(), a.shares.c_str(), "2025-01-15");
+        first[g] = args[0];
+    }
+    // Re-saves every group's first expense unchanged so the next batch recomputes each
+    // settlement instead of copying the cached one.
+    auto touchAll = [&] {
+        for (int g = 0; g < groupCount; ++g) {
+            string name = "batch " + to_string(g);
+            const ExpenseArgs &a = first[g];
+            editExpense(name.c_str(), "1", "Bench expense", "Food", a.amount, a.payer.c_str(),
+                        a.members.c_str(), a.shares.c_str(), "2025-01-15");
+        }
+    };
+    {
+        Measure m;
+        m.untimed(touchAll);
+        calculateSettlementsBatch("*", "heap", 0, 1);
+        m.report(label, "settleBatch threads=1", groupCount);
+    }
+    {
+        Measure m;
+        m.untimed(touchAll);
+        calculateSettlementsBatch("*", "heap", 0, 0);
+        m.report(label, "settleBatch threads=all", groupCount);
+    }
+    {
+        Measure m;
+        calculateSettlementsBatch("*", "heap", 0, 0);
+        m.report(label, "settleBatch cache hit", groupCount);
+    }
+}
+
+int main(int argc, char** argv) {
+    const double mainNs = startupNs();
+    bool full = false;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--full")) full = true;
+        else filter = argv[i];
+    }
+
+    if (!filter || string("startup").find(filter) != string::npos) runStartup(mainNs);
+
+    vector<Scenario> scenarios;
+    const int memberCounts[] = {4, 10, 100, 1000, 10000};
+    const int expenseCounts[] = {100, 10000, 100000, 1000000};
+    for (int members : memberCounts) {
+        for (int expenses : expenseCounts) {
+            if (!full && (expenses > 10000 || members > 1000)) continue;
+            scenarios.push_back({members, expenses, false});
+            scenarios.push_back({members, expenses, true});
+        }
+    }
+
+    for (auto &s : scenarios) {
+        if (filter && scenarioLabel(s).find(filter) == string::npos) continue;
+        run(s);
+    }
+    for (int groupCount : {1000, 100000}) {
+        if (!full && groupCount > 1000) continue;
+        char label[32];
+        snprintf(label, sizeof label, "batch g=%d", groupCount);
+        if (filter && !strstr(label, filter)) continue;
+        runBatch(groupCount);
+    }
+    return 0;
+}
@@ -0,0 +1,471 @@
+// Behaviour checks for the expense engine, through the handle-based C API.
+//
+// Native: g++ -O2 -std=c++17 -pthread expense.cpp expense_test.cpp -o expense_test
+// Checked: g++ -g -std=c++17 -pthread -fsanitize=address,undefined expense.cpp
+//              expense_test.cpp -o expense_test
+//
+// Usage: expense_test [filter]
+//   Runs every test whose name contains filter, prints each failed check and exits
+//   nonzero if any failed. The malformed-input tests feed counts far beyond their
+//   buffers; under ulimit -v they also show that nothing is sized from such a count.
+
+#include "expense.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static int checks = 0, failures = 0;
+
+#define CHECK(cond, detail)                                                              \
+    do {                                                                                 \
+        ++checks;                                                                        \
+        if (!(cond)) {                                                                   \
+            ++failures;                                                                  \
+            printf("  FAIL %s:%d: %s\n    %s\n", __FILE__, __LINE__, #cond, string(detail).c_str()); \
+        }                                                                                \
+    } while (0)
+
+// Takes ownership of an ss_* result.
+static string take(char* result) {
+    string s = result ? result : "(null)";
+    ss_free(result);
+    return s;
+}
+
+static bool ok(const string &json) { return json.find("\"ok\":true") != string::npos; }
+static bool has(const string &json, const char* text) { return json.find(text) != string::npos; }
+
+// getGroupBalances without its "group" field, to compare balances across groups.
+static string balancesOf(SsEngine* e, const char* group) {
+    string json = take(ss_get_group_balances(e, group));
+    size_t at = json.find("\"balances\"");
+    return at == string::npos ? json : json.substr(at);
+}
+
+// The unsigned number after "key": in json, or -1.
+static long field(const string &json, const char* key) {
+    string k = string("\"") + key + "\":";
+    size_t at = json.find(k);
+    return at == string::npos ? -1 : strtol(json.c_str() + at + k.size(), nullptr, 10);
+}
+
+// Builds buffers in the loadGroupExpensesBatch / applyGroupOps layouts.
+struct Packer {
+    vector<unsigned char> out;
+
+    Packer &u8(uint8_t v) { out.push_back(v); return *this; }
+    Packer &u32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back((unsigned char)(v >> (8 * i)));
+        return *this;
+    }
+    Packer &f64(double v) {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof bits);
+        for (int i = 0; i < 8; ++i) out.push_back((unsigned char)(bits >> (8 * i)));
+        return *this;
+    }
+    Packer &str(const string &s) {
+        u32((uint32_t)s.size());
+        out.insert(out.end(), s.begin(), s.end());
+        return *this;
+    }
+    Packer &expense(const string &name, double amount, const string &payer,
+                    const vector<string> &members, const string &date, const string &currency = "") {
+        str(name).str("food").f64(amount).str(payer).u32((uint32_t)members.size());
+        for (auto &m : members) str(m);
+        return u32(0).str(date).str(currency);
+    }
+    int size() const { return (int)out.size(); }
+};
+
+struct Engine {
+    SsEngine* e = ss_engine_create();
+    ~Engine() { ss_engine_destroy(e); }
+    operator SsEngine*() const { return e; }
+};
+
+static string add(SsEngine* e, const char* group, double amount, const char* payer,
+                  const char* members, const char* date, const char* shares = "") {
+    return take(ss_add_group_expense(e, group, "x", "food", amount, payer, members, shares, date));
+}
+
+static void testDuplicates() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b|c"));
+    CHECK(ok(take(ss_set_duplicate_policy(e, "g", "flag"))), "");
+    add(e, "g", 30, "a", "a|b|c", "2024-01-01");
+    string flagged = add(e, "g", 30, "a", "c|b|a", "2024-01-01");
+    CHECK(ok(flagged) && has(flagged, "\"duplicateOf\":\"1\""), flagged);
+    string other = add(e, "g", 30, "b", "a|b|c", "2024-01-01");
+    CHECK(ok(other) && !has(other, "duplicateOf"), other);
+    string sets = take(ss_find_duplicates(e, "g"));
+    CHECK(has(sets, "[\"1\",\"2\"]"), sets);
+
+    CHECK(ok(take(ss_set_duplicate_policy(e, "g", "reject"))), "");
+    string rejected = add(e, "g", 30, "a", "a|b|c", "2024-01-01");
+    CHECK(has(rejected, "Duplicate expense"), rejected);
+    CHECK(has(take(ss_set_duplicate_policy(e, "g", "sometimes")), "error"), "");
+}
+
+static void buildSample(SsEngine* e) {
+    take(ss_create_group(e, "trip", "ann|bob|cat"));
+    take(ss_set_group_currencies(e, "trip", "INR", "USD:83.25"));
+    take(ss_set_duplicate_policy(e, "trip", "flag"));
+    add(e, "trip", 300, "ann", "ann|bob|cat", "2024-03-01");
+    add(e, "trip", 100, "bob", "ann|cat", "2024-03-02", "70|30");
+    add(e, "trip", 45.5, "dave", "bob|cat", "2024-03-05"); // outside payer
+    Packer ops;
+    ops.u32(2).u8(0).str("doc1").expense("hotel", 120, "ann", {"ann", "bob"}, "2024-03-03", "USD");
+    ops.u8(0).str("doc2").expense("taxi", 12, "cat", {"cat", "ann"}, "2024-03-04");
+    take(ss_apply_group_ops(e, "trip", ops.out.data(), ops.size()));
+    take(ss_delete_expense(e, "trip", "2"));
+    take(ss_create_group(e, "empty", "x"));
+}
+
+static void testSnapshotRoundTrip() {
+    Engine a, b;
+    buildSample(a);
+    int size = 0;
+    unsigned char* blob = ss_save_snapshot(a, &size);
+    CHECK(blob && size > 8, "");
+    vector<unsigned char> saved(blob, blob + size);
+    ss_free(blob);
+
+    CHECK(ok(take(ss_load_snapshot(b, saved.data(), (int)saved.size()))), "");
+    for (const char* group : {"trip", "empty"}) {
+        CHECK(take(ss_get_group_balances(a, group)) == take(ss_get_group_balances(b, group)), group);
+        CHECK(take(ss_show_group_expenses(a, group)) == take(ss_show_group_expenses(b, group)), group);
+    }
+    CHECK(take(ss_get_group_sync_state(a, "trip")) == take(ss_get_group_sync_state(b, "trip")), "");
+    CHECK(take(ss_find_duplicates(a, "trip")) == take(ss_find_duplicates(b, "trip")), "");
+    CHECK(take(ss_list_groups(a)) == take(ss_list_groups(b)), "");
+
+    // Saving what was loaded gives the same bytes.
+    blob = ss_save_snapshot(b, &size);
+    CHECK(vector<unsigned char>(blob, blob + size) == saved, "resaved snapshot differs");
+    ss_free(blob);
+}
+
+// A rejected blob must leave the engine as it was.
+static void expectRejected(SsEngine* e, const vector<unsigned char> &blob, const string &before, const char* what) {
+    string result = take(ss_load_snapshot(e, blob.data(), (int)blob.size()));
+    CHECK(has(result, "error"), string(what) + ": " + result);
+    CHECK(take(ss_show_group_expenses(e, "trip")) == before, what);
+}
+
+static void testSnapshotMalformed() {
+    Engine e;
+    buildSample(e);
+    int size = 0;
+    unsigned char* blob = ss_save_snapshot(e, &size);
+    vector<unsigned char> saved(blob, blob + size);
+    ss_free(blob);
+    string before = take(ss_show_group_expenses(e, "trip"));
+
+    vector<unsigned char> bad = saved;
+    bad[0] ^= 1;
+    expectRejected(e, bad, before, "bad magic");
+    bad = saved;
+    bad[4] = 99;
+    expectRejected(e, bad, before, "future version");
+    for (size_t cut = 0; cut < saved.size(); ++cut) {
+        string result = take(ss_load_snapshot(e, saved.data(), (int)cut));
+        if (!has(result, "error")) {
+            CHECK(false, "truncated to " + to_string(cut) + ": " + result);
+            break;
+        }
+    }
+    bad = saved;
+    bad.push_back(0);
+    expectRejected(e, bad, before, "trailing byte");
+
+    // Header, an empty string table, then 2^32 - 1 groups in five bytes.
+    bad.assign(saved.begin(), saved.begin() + 8);
+    bad.insert(bad.end(), {0x00, 0xff, 0xff, 0xff, 0xff, 0x0f});
+    expectRejected(e, bad, before, "huge group count");
+    // The same count with enough bytes for a few groups.
+    bad.resize(bad.size() + 64, 0);
+    expectRejected(e, bad, before, "huge group count, padded");
+}
+
+static void testImportExport() {
+    Engine e;
+    take(ss_create_group(e, "g", "ann|bob"));
+    CHECK(ok(take(ss_begin_group_import(e, "g", "csv"))), "");
+    const string csv =
+        "date,amount,payer,members,name,shares\n"
+        "2024-01-02,10.50,ann,ann|bob,\"lunch, \"\"late\"\"\",\n"
+        "2024-01-03,20,bob,ann|bob,taxi,5|15\n"
+        "2024-01-04,oops,bob,ann,bad,\n"
+        "2024-01-05,7,carl,bob,tip,";
+    for (size_t at = 0; at < csv.size(); at += 7) // chunk edges fall inside quotes and rows
+        take(ss_feed_group_import(e, "g", (const unsigned char*)csv.data() + at, (int)min<size_t>(7, csv.size() - at)));
+    string done = take(ss_finish_group_import(e, "g"));
+    CHECK(ok(done) && field(done, "added") == 3 && field(done, "rejectedCount") == 1, done);
+    string shown = take(ss_show_group_expenses(e, "g"));
+    CHECK(has(shown, "\"name\":\"lunch, \\\"late\\\"\""), shown);
+
+    for (const char* format : {"csv", "ndjson"}) {
+        string text;
+        unsigned char buf[256];
+        int cursor = 0;
+        for (int guard = 0; guard < 100; ++guard) {
+            string r = take(ss_export_group_expenses_chunk(e, "g", format, cursor, buf, sizeof buf));
+            CHECK(ok(r), r);
+            if (!ok(r)) break;
+            text.append((const char*)buf, field(r, "written"));
+            cursor = (int)field(r, "cursor");
+            if (has(r, "\"done\":true")) break;
+        }
+        string copy = string("copy-") + format;
+        take(ss_create_group(e, copy.c_str(), "ann|bob"));
+        take(ss_begin_group_import(e, copy.c_str(), format));
+        take(ss_feed_group_import(e, copy.c_str(), (const unsigned char*)text.data(), (int)text.size()));
+        string r = take(ss_finish_group_import(e, copy.c_str()));
+        CHECK(field(r, "added") == 3, string(format) + ": " + r);
+        CHECK(balancesOf(e, copy.c_str()) == balancesOf(e, "g"), format);
+    }
+
+    unsigned char tiny[4];
+    string r = take(ss_export_group_expenses_chunk(e, "g", "csv", 0, tiny, sizeof tiny));
+    CHECK(has(r, "Buffer too small") && field(r, "needed") > 4, r);
+}
+
+static void testCompaction() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b|c|d"));
+    take(ss_create_group(e, "ref", "a|b|c|d"));
+    const char* names[] = {"a", "b", "c", "d"};
+    for (int i = 1; i <= 400; ++i) {
+        string members = string(names[i % 4]) + "|" + names[(i + 1) % 4];
+        string shares = i % 2 ? to_string(i % 7) + "|" + to_string(i % 5 + 1) : "";
+        double amount = i % 2 ? i % 7 + i % 5 + 1 : i;
+        add(e, "g", amount, names[i % 3], members.c_str(), "2024-02-01", shares.c_str());
+        if (i % 4 == 0) add(e, "ref", amount, names[i % 3], members.c_str(), "2024-02-01", shares.c_str());
+    }
+    // Deleting three in four crosses the tombstone and dead share row thresholds.
+    for (int i = 1; i <= 400; ++i)
+        if (i % 4) CHECK(ok(take(ss_delete_expense(e, "g", to_string(i).c_str()))), to_string(i));
+    CHECK(balancesOf(e, "g") == balancesOf(e, "ref"), "");
+
+    // Surviving ids still resolve after compaction; deleted ones do not.
+    CHECK(ok(take(ss_edit_expense(e, "g", "400", "x", "food", 8, "a", "a|b", "", "2024-02-01"))), "");
+    CHECK(has(take(ss_delete_expense(e, "g", "399")), "Expense not found"), "");
+    string page = take(ss_query_group_expenses(e, "g", 0, -1, "", "", "", ""));
+    CHECK(field(page, "total") == 100, page);
+}
+
+static void fillGroups(SsEngine* e, map<string, string> &balances) {
+    char group[16];
+    for (int k = 0; k < 6; ++k) {
+        snprintf(group, sizeof group, "g%d", k);
+        take(ss_create_group(e, group, "a|b|c"));
+        for (int i = 0; i < 200; ++i) add(e, group, 10 + i + k, i % 2 ? "a" : "z", "a|b|c", "2024-05-01");
+        balances[group] = take(ss_get_group_balances(e, group));
+    }
+}
+
+static void testSpill() {
+    Engine e;
+    map<string, string> balances;
+    fillGroups(e, balances);
+    string r = take(ss_set_memory_budget(e, 16, 1));
+    CHECK(ok(r) && field(r, "evicted") > 0, r);
+    for (auto &b : balances) CHECK(take(ss_get_group_balances(e, b.first.c_str())) == b.second, b.first);
+    string listed = take(ss_list_groups(e));
+    CHECK(has(listed, "\"g0\"") && has(listed, "\"g5\""), listed);
+
+    // Without spill an evicted group is gone.
+    Engine dropping;
+    fillGroups(dropping, balances);
+    r = take(ss_set_memory_budget(dropping, 16, 0));
+    CHECK(ok(r) && field(r, "evicted") > 0, r);
+    int missing = 0;
+    for (auto &b : balances) missing += has(take(ss_get_group_balances(dropping, b.first.c_str())), "Group not found");
+    CHECK(missing == field(r, "evicted"), r);
+}
+
+// calculateSettlementAsOf against a fresh group holding only the expenses on or
+// before the cutoff, across writes in and out of date order.
+static void testAsOf() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b|c|d"));
+    const char* payers[] = {"a", "b", "c", "d", "z"};
+    struct Row { string payer, members, date; double amount; };
+    map<int, Row> live;
+    mt19937 rng(11);
+    char date[16];
+    int nextId = 0, mismatches = 0;
+    auto randomDate = [&] {
+        snprintf(date, sizeof date, "2024-%02d-%02d", 1 + (int)(rng() % 12), 1 + (int)(rng() % 28));
+        return string(date);
+    };
+    for (int step = 0; step < 300; ++step) {
+        int op = rng() % 10;
+        if (op < 6 || live.empty()) {
+            // Mostly in date order, as a live group grows.
+            string d = op < 4 ? "2025-" + to_string(10 + step / 30) + "-01" : randomDate();
+            Row row{payers[rng() % 5], string("a|") + "bcd"[rng() % 3], d, 1 + rng() % 9000 / 100.0};
+            if (ok(add(e, "g", row.amount, row.payer.c_str(), row.members.c_str(), row.date.c_str()))) live[++nextId] = row;
+        } else {
+            auto it = live.begin();
+            advance(it, rng() % live.size());
+            if (op < 8) {
+                it->second.date = randomDate();
+                Row &row = it->second;
+                CHECK(ok(take(ss_edit_expense(e, "g", to_string(it->first).c_str(), "x", "food", row.amount,
+                                              row.payer.c_str(), row.members.c_str(), "", row.date.c_str()))), "");
+            } else {
+                CHECK(ok(take(ss_delete_expense(e, "g", to_string(it->first).c_str()))), "");
+                live.erase(it);
+            }
+        }
+        if (step == 150) take(ss_set_group_members(e, "g", "z"));
+        string asOf = step % 3 ? randomDate() : "2025-" + to_string(10 + (int)(rng() % 11)) + "-01";
+        Engine ref;
+        take(ss_create_group(ref, "g", step > 150 ? "a|b|c|d|z" : "a|b|c|d"));
+        for (auto &kv : live)
+            if (kv.second.date <= asOf)
+                add(ref, "g", kv.second.amount, kv.second.payer.c_str(), kv.second.members.c_str(), kv.second.date.c_str());
+        string want = take(ss_calculate_group_settlement_with(ref, "g", "greedy", 0));
+        string got = take(ss_calculate_settlement_as_of(e, "g", asOf.c_str(), "greedy", 0, nullptr, 0));
+        want = want.substr(want.find("\"settlements\""));
+        size_t at = got.find("\"settlements\"");
+        got = at == string::npos ? got : got.substr(at, got.find(']', at) + 1 - at) + "}";
+        if (want != got && ++mismatches <= 3) CHECK(false, "asOf " + asOf + ": want " + want + " got " + got);
+    }
+    CHECK(mismatches == 0, to_string(mismatches) + " mismatches");
+}
+
+static void testOpLogMalformed() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b"));
+    string before = take(ss_show_group_expenses(e, "g"));
+
+    Packer huge;
+    huge.u32(0xffffffffu).u8(2).str("doc");
+    string r = take(ss_apply_group_ops(e, "g", huge.out.data(), huge.size()));
+    CHECK(has(r, "Malformed op log"), r);
+
+    // A count within the buffer's reach, but more removals than it holds.
+    Packer padded;
+    padded.u32(1000);
+    padded.out.resize(5000, 0);
+    r = take(ss_apply_group_ops(e, "g", padded.out.data(), padded.size()));
+    CHECK(has(r, "Malformed op log") && field(r, "index") >= 0, r);
+
+    Packer cut;
+    cut.u32(2).u8(0).str("doc1").expense("x", 10, "a", {"a", "b"}, "2024-01-01");
+    cut.u8(0).str("doc2").expense("y", 20, "b", {"a", "b"}, "2024-01-02");
+    cut.out.resize(cut.out.size() - 3);
+    r = take(ss_apply_group_ops(e, "g", cut.out.data(), cut.size()));
+    CHECK(has(r, "Malformed op log") && field(r, "index") == 1, r);
+    CHECK(take(ss_show_group_expenses(e, "g")) == before, "a corrupt op log applied ops");
+
+    Packer bad;
+    bad.u32(1).u8(7).str("doc");
+    CHECK(has(take(ss_apply_group_ops(e, "g", bad.out.data(), bad.size())), "Malformed op log"), "");
+    CHECK(take(ss_get_group_sync_state(e, "g")) == "{\"docs\":0}", "");
+
+    // Replays and upserts: added twice, then modified, then removed twice.
+    Packer replay;
+    replay.u32(4).u8(0).str("d").expense("x", 10, "a", {"a", "b"}, "2024-01-01");
+    replay.u8(0).str("d").expense("x", 10, "a", {"a", "b"}, "2024-01-01");
+    replay.u8(1).str("d").expense("x", 16, "b", {"a", "b"}, "2024-01-01");
+    replay.u8(1).str("e").expense("y", 4, "a", {"a"}, "2024-01-01");
+    r = take(ss_apply_group_ops(e, "g", replay.out.data(), replay.size()));
+    CHECK(ok(r) && field(r, "applied") == 4, r);
+    CHECK(take(ss_get_group_sync_state(e, "g")) == "{\"docs\":2}", "");
+    string shown = take(ss_show_group_expenses(e, "g"));
+    CHECK(has(shown, "\"amount\":16.00") && !has(shown, "\"amount\":10.00"), shown);
+    Packer removal;
+    removal.u32(2).u8(2).str("d").u8(2).str("d");
+    CHECK(ok(take(ss_apply_group_ops(e, "g", removal.out.data(), removal.size()))), "");
+    CHECK(take(ss_get_group_sync_state(e, "g")) == "{\"docs\":1}", "");
+}
+
+static void testBatchMalformed() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b"));
+    add(e, "g", 10, "outsider", "a|b", "2024-01-01");
+    string balances = take(ss_get_group_balances(e, "g"));
+    string shown = take(ss_show_group_expenses(e, "g"));
+
+    Packer huge;
+    huge.u32(0xffffffffu).expense("x", 5, "a", {"a"}, "2024-01-02");
+    string r = take(ss_load_group_expenses_batch(e, "g", huge.out.data(), huge.size()));
+    CHECK(has(r, "Malformed batch") && field(r, "index") == 1, r);
+    CHECK(take(ss_show_group_expenses(e, "g")) == shown, "a corrupt batch added rows");
+
+    // New outside payers in the good rows must not survive the rollback.
+    Packer cut;
+    cut.u32(3).expense("x", 5, "newcomer", {"a", "b"}, "2024-01-02");
+    cut.expense("y", 6, "another", {"a"}, "2024-01-03");
+    cut.u32(999);
+    r = take(ss_load_group_expenses_batch(e, "g", cut.out.data(), cut.size()));
+    CHECK(has(r, "Malformed batch") && field(r, "index") == 2, r);
+    CHECK(take(ss_get_group_balances(e, "g")) == balances, take(ss_get_group_balances(e, "g")));
+    CHECK(take(ss_show_group_expenses(e, "g")) == shown, "");
+
+    // The next good batch gets the ids and name slots the failed one gave back.
+    Packer good;
+    good.u32(2).expense("x", 5, "another", {"a", "b"}, "2024-01-02");
+    good.expense("bad", 5, "a", {"nobody"}, "2024-01-02");
+    r = take(ss_load_group_expenses_batch(e, "g", good.out.data(), good.size()));
+    CHECK(ok(r) && field(r, "added") == 1 && has(r, "\"index\":1"), r);
+    CHECK(has(take(ss_show_group_expenses(e, "g")), "\"id\":\"2\""), "");
+    string now = take(ss_get_group_balances(e, "g"));
+    CHECK(has(now, "another") && !has(now, "newcomer"), now);
+}
+
+static void testMembers() {
+    Engine e;
+    take(ss_create_group(e, "g", "a|b"));
+    add(e, "g", 30, "c", "a|b", "2024-01-01");
+    CHECK(has(add(e, "g", 30, "a", "a|c", "2024-01-01"), "error"), "outside payer used as a member");
+    string r = take(ss_set_group_members(e, "g", "a|c|d"));
+    CHECK(ok(r) && field(r, "added") == 2 && field(r, "members") == 4, r);
+    CHECK(take(ss_get_group_members(e, "g")) == "[\"a\",\"b\",\"c\",\"d\"]", "");
+    CHECK(ok(add(e, "g", 30, "a", "a|c", "2024-01-01")), "");
+    string balances = take(ss_get_group_balances(e, "g"));
+    CHECK(balances.find("\"c\"") < balances.find("\"d\""), balances);
+    string settled = take(ss_calculate_group_settlement(e, "g"));
+    CHECK(has(settled, "{\"from\":\"a\",\"to\":\"c\",\"amount\":15.00}") ||
+              has(settled, "{\"from\":\"b\",\"to\":\"c\",\"amount\":15.00}"),
+          settled);
+}
+
+static const struct {
+    const char* name;
+    void (*run)();
+} tests[] = {
+    {"duplicates", testDuplicates},
+    {"snapshot round trip", testSnapshotRoundTrip},
+    {"snapshot malformed", testSnapshotMalformed},
+    {"import export", testImportExport},
+    {"compaction", testCompaction},
+    {"spill", testSpill},
+    {"as of", testAsOf},
+    {"op log malformed", testOpLogMalformed},
+    {"batch malformed", testBatchMalformed},
+    {"members", testMembers},
+};
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    for (auto &t : tests) {
+        if (!strstr(t.name, filter)) continue;
+        int before = failures;
+        printf("%s\n", t.name);
+        t.run();
+        if (failures > before) printf("  %d failed\n", failures - before);
+    }
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}